@@ -1,11 +1,27 @@
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <messagecache/asio_cache.hpp>
+#include <messagecache/coro_cache.hpp>
+#include <messagecache/frame_arena.hpp>
 #include <messagecache/ring_buffer.hpp>
+#include <messagecache/ring_resource.hpp>
+#include <messagecache/slab_cache.hpp>
+#include <messagecache/tracing.hpp>
 
 #include <benchmark/benchmark.h>
 
+#include <coroutine>
+#include <deque>
+#include <exception>
 #include <iostream>
+#include <memory_resource>
+#include <numeric>
+#include <string>
 #include <thread>
+#include <vector>
 
 
 static void pinThread(int cpu)
@@ -65,4 +81,627 @@ void try_alloc(benchmark::State& state)
 
 BENCHMARK(try_alloc);
 
+
+// FIFO traffic through a queue that keeps many slot handles in flight
+void queued_slots(benchmark::State& state)
+{
+    using buf_type = messagecache::ring_buffer<1 << 22>;
+    using counter_type = std::int_fast64_t;
+
+    auto const in_flight = static_cast<std::size_t>(state.range(0));
+
+    buf_type fifo;
+    std::deque<buf_type::slot> queue;
+
+    for(std::size_t i = 0; i < in_flight; ++i) {
+        queue.push_back(fifo.try_alloc(16));
+    }
+
+    auto value = counter_type{};
+    for(auto _ : state) {
+        queue.pop_front();
+        queue.push_back(fifo.try_alloc(16));
+        benchmark::DoNotOptimize(queue.back());
+
+        ++value;
+    }
+    state.counters["ops/sec"] =
+        benchmark::Counter(double(value), benchmark::Counter::kIsRate);
+    state.counters["handle bytes"] = double(sizeof(buf_type::slot) * in_flight);
+}
+
+
+BENCHMARK(queued_slots)->Arg(1 << 10)->Arg(1 << 14)->Arg(1 << 17);
+
+
+// bounded single-producer single-consumer channel to hand slots between two threads
+template<typename Slot, std::size_t N>
+class spsc_channel
+{
+public:
+    auto try_push(Slot& slot) -> bool
+    {
+        auto const head = head_.load(std::memory_order_relaxed);
+        if(head - tail_.load(std::memory_order_acquire) == N) {
+            return false;
+        }
+        items_[head % N] = std::move(slot);
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    auto try_pop(Slot& slot) -> bool
+    {
+        auto const tail = tail_.load(std::memory_order_relaxed);
+        if(tail == head_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        slot = std::move(items_[tail % N]);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::array<Slot, N> items_;
+    alignas(64) std::atomic<std::size_t> head_ = 0;
+    alignas(64) std::atomic<std::size_t> tail_ = 0;
+};
+
+
+// producer fills and flushes slots, the consumer synchronizes, reads and releases them
+template<typename Policy>
+void handoff(benchmark::State& state)
+{
+    using buf_type = messagecache::ring_buffer<131072, Policy>;
+    using counter_type = std::int_fast64_t;
+
+    buf_type fifo;
+    spsc_channel<typename buf_type::slot, 1024> channel;
+
+    std::atomic_flag finished;
+
+    auto t1 = std::jthread([&] {
+        pinThread(cpu1);
+        while(not finished.test(std::memory_order_relaxed)) {
+            typename buf_type::slot slot;
+            if(channel.try_pop(slot)) {
+                auto span = slot.asSpan();
+                benchmark::DoNotOptimize(span[0]);
+            }
+        }
+    });
+
+    messagecache::tracing::reset();
+
+    auto value = counter_type{};
+    pinThread(cpu2);
+    for(auto _ : state) {
+        auto slot = fifo.try_alloc(16);
+        if(not slot) {
+            continue;
+        }
+        slot.begin()[0] = std::byte{42};
+        slot.flush();
+        while(not channel.try_push(slot)) {
+        }
+
+        ++value;
+    }
+    state.counters["msgs/sec"] =
+        benchmark::Counter(double(value), benchmark::Counter::kIsRate);
+
+    finished.test_and_set();
+    t1.join();
+
+    if constexpr(messagecache::tracing::enabled) {
+        auto const report = messagecache::tracing::snapshot();
+        state.counters["handoff p50 ns"] =
+            double(report.handoff.percentile(0.5).count());
+        state.counters["handoff p99 ns"] =
+            double(report.handoff.percentile(0.99).count());
+        state.counters["residency p99 ns"] =
+            double(report.residency.percentile(0.99).count());
+    }
+}
+
+
+BENCHMARK_TEMPLATE(handoff, messagecache::concurrency::spsc);
+BENCHMARK_TEMPLATE(handoff, messagecache::concurrency::mpsc);
+BENCHMARK_TEMPLATE(handoff, messagecache::concurrency::mpmc);
+
+
+// the consumer drains slots from a producer thread and releases them in batches
+template<std::size_t BATCH>
+void drain(benchmark::State& state)
+{
+    using buf_type = messagecache::ring_buffer<131072, messagecache::concurrency::spsc>;
+    using counter_type = std::int_fast64_t;
+
+    buf_type fifo;
+    spsc_channel<buf_type::slot, 1024> channel;
+
+    std::atomic_flag finished;
+
+    auto t1 = std::jthread([&] {
+        pinThread(cpu1);
+        while(not finished.test(std::memory_order_relaxed)) {
+            auto slot = fifo.try_alloc(16);
+            if(not slot) {
+                continue;
+            }
+            slot.begin()[0] = std::byte{42};
+            slot.flush();
+            while(not channel.try_push(slot)
+                  and not finished.test(std::memory_order_relaxed)) {
+            }
+        }
+    });
+
+    auto value = counter_type{};
+    pinThread(cpu2);
+    {
+        buf_type::release_batch<BATCH> batch{fifo};
+        for(auto _ : state) {
+            buf_type::slot slot;
+            while(not channel.try_pop(slot)) {
+            }
+            auto span = slot.asSpan();
+            benchmark::DoNotOptimize(span[0]);
+            batch.release(std::move(slot));
+
+            ++value;
+        }
+    }
+    state.counters["msgs/sec"] =
+        benchmark::Counter(double(value), benchmark::Counter::kIsRate);
+
+    finished.test_and_set();
+}
+
+
+BENCHMARK_TEMPLATE(drain, 1);
+BENCHMARK_TEMPLATE(drain, 16);
+BENCHMARK_TEMPLATE(drain, 256);
+
+
+// allocation and immediate release on a single thread
+template<typename Policy>
+void alloc_release(benchmark::State& state)
+{
+    using buf_type = messagecache::ring_buffer<131072, Policy>;
+    using counter_type = std::int_fast64_t;
+
+    buf_type fifo;
+
+    auto value = counter_type{};
+    for(auto _ : state) {
+        auto slot = fifo.try_alloc(16);
+        benchmark::DoNotOptimize(slot);
+
+        ++value;
+    }
+    state.counters["ops/sec"] =
+        benchmark::Counter(double(value), benchmark::Counter::kIsRate);
+}
+
+
+BENCHMARK_TEMPLATE(alloc_release, messagecache::concurrency::single_thread);
+BENCHMARK_TEMPLATE(alloc_release, messagecache::concurrency::spsc);
+BENCHMARK_TEMPLATE(alloc_release, messagecache::concurrency::mpsc);
+BENCHMARK_TEMPLATE(alloc_release, messagecache::concurrency::mpmc);
+
+// the try_alloc workload, served by one slab_cache per thread over a shared ring
+void slab_try_alloc(benchmark::State& state)
+{
+    using buf_type = messagecache::ring_buffer<131072>;
+    using cache_type = messagecache::slab_cache<buf_type>;
+    using counter_type = std::int_fast64_t;
+
+    buf_type fifo;
+
+    std::atomic_flag finished;
+
+    auto t1 = std::jthread([&] {
+        pinThread(cpu1);
+        cache_type cache(fifo);
+        for(auto i = counter_type{};; ++i) {
+            auto slot = cache.try_alloc(16);
+            benchmark::DoNotOptimize(slot);
+
+            if(finished.test(std::memory_order_relaxed)) {
+                break;
+            }
+        }
+    });
+
+    auto value = counter_type{};
+    pinThread(cpu2);
+    {
+        cache_type cache(fifo);
+        for(auto _ : state) {
+
+            auto slot = cache.try_alloc(16);
+            benchmark::DoNotOptimize(slot);
+
+            ++value;
+        }
+    }
+    state.counters["ops/sec (1T)"] =
+        benchmark::Counter(double(value), benchmark::Counter::kIsRate);
+
+    finished.test_and_set();
+}
+
+
+BENCHMARK(slab_try_alloc);
+
+
+// tiny messages held in a FIFO, the ring serves them directly or through slabs
+template<bool USE_SLABS>
+void tiny_fifo(benchmark::State& state)
+{
+    using buf_type = messagecache::ring_buffer<1 << 20>;
+    using cache_type = messagecache::slab_cache<buf_type>;
+    using slot_type =
+        std::conditional_t<USE_SLABS, typename cache_type::slot, typename buf_type::slot>;
+    using counter_type = std::int_fast64_t;
+
+    buf_type fifo;
+    cache_type cache(fifo);
+
+    auto alloc = [&](std::size_t size) -> slot_type {
+        if constexpr(USE_SLABS) {
+            return cache.try_alloc(size);
+        } else {
+            return fifo.try_alloc(size);
+        }
+    };
+
+    std::deque<slot_type> queue;
+    for(std::size_t i = 0; i < 1024; ++i) {
+        queue.push_back(alloc(16 + i % 48));
+    }
+
+    auto value = counter_type{};
+    for(auto _ : state) {
+        // release slightly out of order
+        std::swap(queue[0], queue[value % 8]);
+        queue.pop_front();
+        queue.push_back(alloc(16 + value % 48));
+        benchmark::DoNotOptimize(queue.back());
+
+        ++value;
+    }
+    state.counters["ops/sec"] =
+        benchmark::Counter(double(value), benchmark::Counter::kIsRate);
+}
+
+
+BENCHMARK_TEMPLATE(tiny_fifo, false);
+BENCHMARK_TEMPLATE(tiny_fifo, true);
+
+
+// Overload: two messages arrive per tick, the consumer drains one.
+// Without watermarks the producer keeps retrying allocations in a full cache,
+// with watermarks it pauses between the high and the low signal and sheds the load.
+template<bool WATERMARKS>
+void overload(benchmark::State& state)
+{
+    using cache_type = messagecache::asio_cache<65536>;
+    using counter_type = std::int_fast64_t;
+
+    cache_type cache;
+    std::deque<cache_type::slot> backlog;
+
+    bool paused = false;
+    if constexpr(WATERMARKS) {
+        cache.set_watermarks(cache.capacity() / 4,
+                             cache.capacity() * 3 / 4,
+                             [&] { paused = true; },
+                             [&] { paused = false; });
+    }
+
+    auto delivered = counter_type{};
+    auto failed = counter_type{};
+    auto shed = counter_type{};
+    for(auto _ : state) {
+        for(int i = 0; i < 2; ++i) {
+            if(paused) {
+                ++shed;
+                continue;
+            }
+            auto slot = cache.try_alloc(64);
+            if(not slot) {
+                ++failed;
+                continue;
+            }
+            backlog.push_back(std::move(slot));
+        }
+
+        if(not backlog.empty()) {
+            backlog.pop_front();
+            ++delivered;
+        }
+    }
+    state.counters["delivered/sec"] =
+        benchmark::Counter(double(delivered), benchmark::Counter::kIsRate);
+    state.counters["failed allocs/sec"] =
+        benchmark::Counter(double(failed), benchmark::Counter::kIsRate);
+    state.counters["shed/sec"] =
+        benchmark::Counter(double(shed), benchmark::Counter::kIsRate);
+}
+
+
+BENCHMARK_TEMPLATE(overload, false);
+BENCHMARK_TEMPLATE(overload, true);
+
+
+// Urgent control messages while bulk traffic keeps the ring saturated.
+// The bulk producer refills the ring after every urgent attempt.
+template<bool RESERVE>
+void urgent_under_load(benchmark::State& state)
+{
+    using ring_type =
+        messagecache::ring_buffer<65536, messagecache::concurrency::single_thread>;
+    using counter_type = std::int_fast64_t;
+
+    ring_type ring;
+    if constexpr(RESERVE) {
+        ring.reserve(4 * 128);
+    }
+    std::deque<ring_type::slot> backlog;
+
+    auto fill = [&] {
+        while(auto slot = ring.try_alloc(1024)) {
+            backlog.push_back(std::move(slot));
+        }
+    };
+
+    auto delivered = counter_type{};
+    auto failed = counter_type{};
+    auto max_latency = std::chrono::nanoseconds{};
+    fill();
+    for(auto _ : state) {
+        auto const start = std::chrono::steady_clock::now();
+        auto urgent = ring.try_alloc(128, messagecache::priority::high);
+        auto const latency = std::chrono::steady_clock::now() - start;
+        max_latency = std::max(max_latency, latency);
+
+        if(urgent) {
+            ++delivered;
+        } else {
+            ++failed;
+        }
+        benchmark::DoNotOptimize(urgent);
+        urgent.release();
+
+        // the consumer drains one bulk message, the producer fills it up again
+        backlog.pop_front();
+        fill();
+    }
+    state.counters["urgent delivered"] = double(delivered);
+    state.counters["urgent failed"] = double(failed);
+    state.counters["max latency ns"] = double(max_latency.count());
+}
+
+
+BENCHMARK_TEMPLATE(urgent_under_load, false);
+BENCHMARK_TEMPLATE(urgent_under_load, true);
+
+
+// A burst larger than the ring meets a slow consumer. Without overflow rings the
+// producer stalls until the consumer handed a message back.
+template<bool ELASTIC>
+void burst(benchmark::State& state)
+{
+    using ring_type =
+        messagecache::ring_buffer<65536, messagecache::concurrency::single_thread>;
+    constexpr std::size_t burst_size = 256; // about four rings worth of messages
+
+    ring_type ring;
+    if constexpr(ELASTIC) {
+        ring.set_overflow(4);
+    }
+    std::deque<ring_type::slot> backlog;
+
+    // the consumer reads the whole message before it releases it
+    auto consume = [&] {
+        auto span = backlog.front().asSpan(messagecache::same_thread);
+        auto sum = std::accumulate(span.begin(), span.end(), std::byte{0},
+                                   [](auto a, auto b) { return a ^ b; });
+        benchmark::DoNotOptimize(sum);
+        backlog.pop_front();
+    };
+
+    std::vector<std::chrono::nanoseconds> latencies;
+    for(auto _ : state) {
+        for(std::size_t i = 0; i < burst_size; ++i) {
+            auto const start = std::chrono::steady_clock::now();
+            auto slot = ring.try_alloc(1024);
+            while(not slot) {
+                consume();
+                slot = ring.try_alloc(1024);
+            }
+            latencies.push_back(std::chrono::steady_clock::now() - start);
+            backlog.push_back(std::move(slot));
+        }
+        while(not backlog.empty()) {
+            consume();
+        }
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) {
+        return double(latencies[std::size_t(p * double(latencies.size() - 1))].count());
+    };
+    state.counters["p50 ns"] = percentile(0.5);
+    state.counters["p99 ns"] = percentile(0.99);
+    state.counters["max ns"] = double(latencies.back().count());
+}
+
+
+BENCHMARK_TEMPLATE(burst, false);
+BENCHMARK_TEMPLATE(burst, true);
+
+
+enum class decode_memory
+{
+    heap,
+    monotonic,
+    ring
+};
+
+// decodes a message into pmr containers and drops it again
+template<decode_memory MEMORY>
+void decode(benchmark::State& state)
+{
+    using ring_type =
+        messagecache::ring_buffer<65536, messagecache::concurrency::single_thread>;
+    using counter_type = std::int_fast64_t;
+
+    ring_type ring;
+
+    auto build = [](std::pmr::memory_resource* resource) {
+        std::pmr::vector<std::pmr::string> fields(resource);
+        for(int i = 0; i < 16; ++i) {
+            fields.emplace_back("a decoded field that exceeds the small string buffer");
+        }
+        benchmark::DoNotOptimize(fields.data());
+    };
+
+    auto value = counter_type{};
+    for(auto _ : state) {
+        if constexpr(MEMORY == decode_memory::heap) {
+            build(std::pmr::get_default_resource());
+        } else if constexpr(MEMORY == decode_memory::monotonic) {
+            std::pmr::monotonic_buffer_resource resource;
+            build(&resource);
+        } else {
+            messagecache::ring_resource<ring_type> resource(ring, 2048);
+            build(&resource);
+        }
+
+        ++value;
+    }
+    state.counters["msgs/sec"] =
+        benchmark::Counter(double(value), benchmark::Counter::kIsRate);
+}
+
+
+BENCHMARK_TEMPLATE(decode, decode_memory::heap);
+BENCHMARK_TEMPLATE(decode, decode_memory::monotonic);
+BENCHMARK_TEMPLATE(decode, decode_memory::ring);
+
+
+// Receives messages over a local socketpair into the cache.
+// Either allocates and reads in two operations, or with async_read_into_cache.
+template<bool COMPOSED>
+void receive(benchmark::State& state)
+{
+    using cache_type = messagecache::asio_cache<65536>;
+    using counter_type = std::int_fast64_t;
+
+    asio::io_context ctx;
+    asio::local::stream_protocol::socket rx(ctx);
+    asio::local::stream_protocol::socket tx(ctx);
+    asio::local::connect_pair(rx, tx);
+
+    cache_type cache;
+    std::array<std::byte, 64> message{};
+
+    auto value = counter_type{};
+    for(auto _ : state) {
+        asio::write(tx, asio::buffer(message));
+
+        if constexpr(COMPOSED) {
+            cache.async_read_into_cache(rx, 1024, [&](asio::error_code, auto slot) {
+                benchmark::DoNotOptimize(slot.begin());
+            });
+        } else {
+            cache.alloc(1024, asio::bind_executor(ctx, [&](asio::error_code, auto slot) {
+                auto buffer = slot.getWriteBuffer();
+                rx.async_read_some(buffer,
+                                   [slot = std::move(slot)](asio::error_code,
+                                                            std::size_t n) mutable {
+                                       slot.shrink(n);
+                                       benchmark::DoNotOptimize(slot.begin());
+                                   });
+            }));
+        }
+        ctx.run();
+        ctx.restart();
+
+        ++value;
+    }
+    state.counters["msgs/sec"] =
+        benchmark::Counter(double(value), benchmark::Counter::kIsRate);
+}
+
+
+BENCHMARK_TEMPLATE(receive, false);
+BENCHMARK_TEMPLATE(receive, true);
+
+
+using frame_arena_type =
+    messagecache::frame_arena<65536, messagecache::concurrency::single_thread>;
+
+// eagerly started coroutine, its frame comes from the heap or from a frame_arena
+template<bool ARENA>
+struct receive_task
+{
+    struct heap_promise
+    {};
+    using promise_base = std::conditional_t<ARENA,
+                                            messagecache::arena_frame<frame_arena_type>,
+                                            heap_promise>;
+
+    struct promise_type : promise_base
+    {
+        auto get_return_object() noexcept -> receive_task { return {}; }
+        auto initial_suspend() noexcept -> std::suspend_never { return {}; }
+        auto final_suspend() noexcept -> std::suspend_never { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+// GCC pairs the arena frame's template operator new with a template operator delete,
+// which cannot exist. Its -Wmismatched-new-delete is a false positive here.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+template<bool ARENA, typename Cache>
+auto receive_one(std::allocator_arg_t, frame_arena_type&, Cache& cache)
+    -> receive_task<ARENA>
+{
+    auto slot = co_await cache.alloc(64);
+    slot.begin()[0] = std::byte{42};
+    benchmark::DoNotOptimize(slot.begin());
+}
+#pragma GCC diagnostic pop
+
+// spawns short-lived coroutines that receive one message each and complete
+template<bool ARENA>
+void spawn(benchmark::State& state)
+{
+    using cache_type =
+        messagecache::coro_cache<65536, messagecache::concurrency::single_thread>;
+    using counter_type = std::int_fast64_t;
+
+    cache_type cache;
+    frame_arena_type arena;
+
+    auto value = counter_type{};
+    for(auto _ : state) {
+        receive_one<ARENA>(std::allocator_arg, arena, cache);
+
+        ++value;
+    }
+    state.counters["coroutines/sec"] =
+        benchmark::Counter(double(value), benchmark::Counter::kIsRate);
+}
+
+
+BENCHMARK_TEMPLATE(spawn, false);
+BENCHMARK_TEMPLATE(spawn, true);
+
 BENCHMARK_MAIN();
\ No newline at end of file
@@ -6,32 +6,38 @@
 #include <boost/asio.hpp>
 #endif
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+
 #include <messagecache/ring_buffer.hpp>
 
 namespace messagecache {
 
 
-template<std::size_t SIZE>
-class asio_cache : public ring_buffer<SIZE>
+template<std::size_t SIZE, typename Policy = concurrency::mpmc>
+class asio_cache : public ring_buffer<SIZE, Policy>
 {
 public:
-    using T = ring_buffer<SIZE>::T;
+    using T = ring_buffer<SIZE, Policy>::T;
+    using offset_type = ring_buffer<SIZE, Policy>::offset_type;
 
     /**
      * A slot takes ownership over a sequence of bytes in the cache.
      * While a caller holds its slot, the data will not be erased from the cache.
      * As soon as the slot is destroyed, the cache may reuse the storage.
      */
-    class slot : public ring_buffer<SIZE>::slot
+    class slot : public ring_buffer<SIZE, Policy>::slot
     {
     private:
         friend asio_cache;
 
     public:
-        constexpr slot() noexcept : ring_buffer<SIZE>::slot() {}
+        constexpr slot() noexcept : ring_buffer<SIZE, Policy>::slot() {}
 
-        constexpr slot(asio_cache& buffer, T* start, std::size_t size)
-            : ring_buffer<SIZE>::slot(buffer, start, size)
+        constexpr slot(asio_cache& buffer, offset_type start, std::size_t size)
+            : ring_buffer<SIZE, Policy>::slot(buffer, start, size)
         {}
 
         // move only
@@ -42,8 +48,8 @@ public:
         constexpr auto operator=(const slot&) noexcept -> slot& = delete;
 
         // implicit downcast-conversion
-        constexpr slot(ring_buffer<SIZE>::slot&& other) noexcept
-            : ring_buffer<SIZE>::slot(std::move(other))
+        constexpr slot(ring_buffer<SIZE, Policy>::slot&& other) noexcept
+            : ring_buffer<SIZE, Policy>::slot(std::move(other))
         {}
 
         /**
@@ -52,7 +58,7 @@ public:
          */
         auto getWriteBuffer() const -> asio::mutable_buffer
         {
-            // TODO: synchronize before?
+            // the writing thread owns the region, nothing to synchronize
             return {this->begin(), static_cast<std::size_t>(this->end() - this->begin())};
         }
 
@@ -66,25 +72,110 @@ public:
             this->synchronize();
             return getWriteBuffer(); // a mutable_buffer is implicitly convertible to const_buffer
         }
+
+        /**
+         * Returns an asio::const_buffer that spans the slot's memory region.
+         * Skips synchronization, the caller must have filled the slot itself.
+         */
+        auto getConstBuffer(same_thread_t) const -> asio::const_buffer
+        {
+            return getWriteBuffer();
+        }
     };
 
 
+    // try to allocate a slot of the given size
+    auto try_alloc(std::size_t slot_size, priority prio = priority::normal) noexcept
+        -> slot
+    {
+        slot ret = ring_buffer<SIZE, Policy>::try_alloc(slot_size, prio);
+        if(ret and high_ != 0) {
+            checkHighWatermark();
+        }
+        return ret;
+    }
+
+    /**
+     * Signals when the occupancy (see ring_buffer::occupancy()) crosses the given
+     * watermarks, e.g. to pause reading from sockets while the cache fills up and
+     * to resume once it drained.
+     * on_high is invoked by the thread whose allocation lifted the occupancy to at
+     * least high bytes, on_low by the thread whose release brought it down to at
+     * most low bytes. The signals alternate, starting with on_high. on_low does not
+     * run before on_high returned, if the cache drains in the meantime, on_low is
+     * invoked by the thread that signalled on_high.
+     * Keep the callbacks short, they run inside alloc() and slot releases.
+     * Not thread-safe, configure the watermarks before using the cache.
+     */
+    void set_watermarks(std::size_t low,
+                        std::size_t high,
+                        std::function<void()> on_high,
+                        std::function<void()> on_low)
+    {
+        assert(low < high && high <= this->capacity());
+
+        low_ = low;
+        high_ = high;
+        on_high_ = std::move(on_high);
+        on_low_ = std::move(on_low);
+
+        this->setReleaseHook(&asio_cache::onRelease);
+    }
+
+    // returns true between the on_high and the on_low signal
+    auto above_high_watermark() const noexcept -> bool
+    {
+        return watermark_.load(std::memory_order_relaxed) != BELOW;
+    }
+
     // asynchronously attempt to allocate a new buffer slot with the given size
     template<typename CompletionToken>
     auto alloc(std::size_t slot_size, CompletionToken&& token) noexcept
+    {
+        return alloc(slot_size, priority::normal, std::forward<CompletionToken>(token));
+    }
+
+    /**
+     * Asynchronously attempt to allocate a new buffer slot with the given size.
+     * High priority allocations may use the capacity set aside by reserve().
+     * If the slot can be allocated right away, the completion is posted once, without
+     * another attempt from the executor. So is the failure of an allocation the ring
+     * can never satisfy, see max_slot_size(), with asio::error::message_size.
+     */
+    template<typename CompletionToken>
+    auto alloc(std::size_t slot_size, priority prio, CompletionToken&& token) noexcept
     {
         return asio::async_initiate<decltype(token), void(asio::error_code, slot)>(
-            [this, slot_size](auto&& token) {
+            [this, slot_size, prio](auto&& token) {
                 auto executor = asio::get_associated_executor(token);
                 auto state = asio::cancellation_state(
                     asio::get_associated_cancellation_slot(token));
 
+                // waiting for space would never end
+                if(slot_size > this->max_slot_size(prio)) {
+                    postCompletion(std::forward<decltype(token)>(token),
+                                   executor,
+                                   asio::error::message_size,
+                                   slot{});
+                    return;
+                }
+
+                // fast path, do not go through the scheduler if there is space
+                if(auto ret = this->try_alloc(slot_size, prio)) {
+                    postCompletion(std::forward<decltype(token)>(token),
+                                   executor,
+                                   asio::error_code{},
+                                   std::move(ret));
+                    return;
+                }
+
                 asio::post(executor,
                            [this,
                             slot_size,
+                            prio,
                             token = std::forward<decltype(token)>(token),
                             state]() mutable {
-                               std::error_code e;
+                               asio::error_code e;
                                if(state.cancelled() != asio::cancellation_type::none) {
                                    // function is cancelled
                                    e = asio::error::operation_aborted;
@@ -96,17 +187,202 @@ public:
                                }
 
                                // try to allocate
-                               auto slot = this->try_alloc(slot_size);
+                               auto slot = this->try_alloc(slot_size, prio);
                                if(slot) {
                                    // allocation successful
                                    std::move(token)(e, std::move(slot));
                                } else {
                                    // yield
-                                   alloc(slot_size, std::move(token));
+                                   alloc(slot_size, prio, std::move(token));
                                }
                            });
             },
             token);
     }
+
+    /**
+     * Allocates a slot of max_size bytes and reads from the stream into it.
+     * Completes with the slot shrunk to the number of bytes read, as a single
+     * operation: allocation and read share the handler and its allocator.
+     * Reads at most max_slot_size() bytes, a larger max_size is cut down to it.
+     * An empty slot is passed to the handler if the read failed without data.
+     */
+    template<typename AsyncReadStream, typename CompletionToken>
+    auto async_read_into_cache(AsyncReadStream& stream,
+                               std::size_t max_size,
+                               CompletionToken&& token)
+    {
+        auto const size = std::min(max_size, this->max_slot_size());
+        return asio::async_compose<CompletionToken, void(asio::error_code, slot)>(
+            read_op<AsyncReadStream>{*this, stream, size}, token, stream);
+    }
+
+private:
+    // allocates a slot, then reads into it. See async_read_into_cache().
+    template<typename AsyncReadStream>
+    struct read_op
+    {
+        asio_cache& cache_;
+        AsyncReadStream& stream_;
+        std::size_t size_;
+        slot slot_ = {};
+
+        template<typename Self>
+        void operator()(Self& self)
+        {
+            // skip the allocation operation if there is space
+            if(auto ret = cache_.try_alloc(size_)) {
+                (*this)(self, asio::error_code{}, std::move(ret));
+            } else {
+                cache_.alloc(size_, std::move(self));
+            }
+        }
+
+        template<typename Self>
+        void operator()(Self& self, asio::error_code e, slot allocated)
+        {
+            if(e) {
+                self.complete(e, slot{});
+                return;
+            }
+            slot_ = std::move(allocated);
+            stream_.async_read_some(slot_.getWriteBuffer(), std::move(self));
+        }
+
+        template<typename Self>
+        void operator()(Self& self, asio::error_code e, std::size_t bytes_read)
+        {
+            if(bytes_read == 0) {
+                slot_.release();
+            }
+            slot_.shrink(bytes_read);
+            self.complete(e, std::move(slot_));
+        }
+    };
+
+    /**
+     * Completes an operation that finished within its initiating function.
+     * The handler must not run inside the initiating function, appending the result
+     * keeps the handler's associated allocator and cancellation slot.
+     */
+    template<typename Handler, typename Executor>
+    static void postCompletion(Handler&& handler,
+                               const Executor& executor,
+                               asio::error_code e,
+                               slot ret)
+    {
+        asio::post(executor,
+                   asio::append(std::forward<Handler>(handler), e, std::move(ret)));
+    }
+
+    void checkHighWatermark() noexcept
+    {
+        if(watermark_.load(std::memory_order_relaxed) != BELOW
+           or this->occupancy() < high_) {
+            return;
+        }
+
+        auto expected = BELOW;
+        if(not watermark_.compare_exchange_strong(expected,
+                                                  SIGNALLING,
+                                                  std::memory_order_acq_rel,
+                                                  std::memory_order_relaxed)) {
+            return;
+        }
+        if(on_high_) {
+            on_high_();
+        }
+
+        // a release that drained the cache while on_high ran left on_low to us
+        expected = SIGNALLING;
+        if(watermark_.compare_exchange_strong(
+               expected, ABOVE, std::memory_order_acq_rel, std::memory_order_acquire)) {
+            // pairs with the fence in onRelease(), a release that missed the signal
+            // is seen here
+            if constexpr(Policy::concurrent and detail::fences_supported) {
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+            }
+            if(this->occupancy() > low_) {
+                return;
+            }
+            expected = ABOVE;
+            if(not watermark_.compare_exchange_strong(expected,
+                                                      BELOW,
+                                                      std::memory_order_acq_rel,
+                                                      std::memory_order_relaxed)) {
+                return;
+            }
+        } else {
+            watermark_.store(BELOW, std::memory_order_release);
+        }
+        if(on_low_) {
+            on_low_();
+        }
+    }
+
+    static void onRelease(ring_buffer<SIZE, Policy>& ring) noexcept
+    {
+        auto& self = static_cast<asio_cache&>(ring);
+
+        // pairs with the fence in checkHighWatermark(), either this thread sees the
+        // signal or the signalling thread sees the release
+        auto state = BELOW;
+        if constexpr(not Policy::concurrent or detail::fences_supported) {
+            if constexpr(Policy::concurrent) {
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+            }
+            state = self.watermark_.load(std::memory_order_relaxed);
+        } else if(self.watermark_.compare_exchange_strong(state,
+                                                          BELOW,
+                                                          std::memory_order_acq_rel,
+                                                          std::memory_order_relaxed)) {
+            // a read-modify-write orders like the fences, the signalling thread
+            // acquires it with its own
+            return;
+        }
+        if(state == BELOW or state == DRAINED) {
+            return;
+        }
+
+        // the release of the slot at the free cursor passes the slots behind it that
+        // were released out of order, unless another consumer released them meanwhile;
+        // only then is the cursor stuck and a reclaim worth the producer lock
+        if(self.occupancy() > self.low_) {
+            self.reclaim();
+            if(self.occupancy() > self.low_) {
+                return;
+            }
+        }
+
+        while(state == ABOVE or state == SIGNALLING) {
+            auto const next = state == ABOVE ? BELOW : DRAINED;
+            if(self.watermark_.compare_exchange_weak(
+                   state, next, std::memory_order_acq_rel, std::memory_order_relaxed)) {
+                if(next == BELOW and self.on_low_) {
+                    self.on_low_();
+                }
+                return;
+            }
+        }
+    }
+
+    std::size_t low_ = 0;
+    std::size_t high_ = 0; // zero disables the watermarks
+    std::function<void()> on_high_;
+    std::function<void()> on_low_;
+
+    // BELOW -> SIGNALLING (on_high runs) -> ABOVE -> BELOW (on_low runs)
+    // SIGNALLING -> DRAINED, the cache drained while on_high ran
+    enum watermark_state : std::uint8_t
+    {
+        BELOW,
+        SIGNALLING,
+        ABOVE,
+        DRAINED,
+    };
+    using state_type = std::conditional_t<Policy::concurrent,
+                                          std::atomic<watermark_state>,
+                                          detail::plain_atomic<watermark_state>>;
+    state_type watermark_ = BELOW;
 };
 } // namespace messagecache
\ No newline at end of file
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <atomic>
+
+namespace messagecache {
+
+/**
+ * Concurrency policies for ring_buffer and the caches built on top of it.
+ * Producers are the threads that allocate slots, consumers are the threads
+ * that release them.
+ * The policy selects the synchronization protocol at compile time, a cache that
+ * never leaves a single thread compiles to plain loads and stores.
+ */
+namespace concurrency {
+
+// all allocations and releases happen on the same thread
+struct single_thread
+{
+    constexpr static bool concurrent = false;
+    constexpr static bool multi_producer = false;
+    constexpr static bool multi_consumer = false;
+};
+
+// one thread allocates, another one releases
+struct spsc
+{
+    constexpr static bool concurrent = true;
+    constexpr static bool multi_producer = false;
+    constexpr static bool multi_consumer = false;
+};
+
+// any thread allocates, one thread releases
+struct mpsc
+{
+    constexpr static bool concurrent = true;
+    constexpr static bool multi_producer = true;
+    constexpr static bool multi_consumer = false;
+};
+
+// any thread allocates, any thread releases
+struct mpmc
+{
+    constexpr static bool concurrent = true;
+    constexpr static bool multi_producer = true;
+    constexpr static bool multi_consumer = true;
+};
+
+} // namespace concurrency
+
+namespace detail {
+
+// ThreadSanitizer does not model std::atomic_thread_fence, code that publishes
+// through a fence followed by relaxed stores uses release stores instead.
+#if defined(__SANITIZE_THREAD__)
+inline constexpr bool fences_supported = false;
+#elif defined(__has_feature)
+#if __has_feature(thread_sanitizer)
+inline constexpr bool fences_supported = false;
+#else
+inline constexpr bool fences_supported = true;
+#endif
+#else
+inline constexpr bool fences_supported = true;
+#endif
+
+/**
+ * Drop-in for std::atomic that is only ever accessed by a single thread.
+ * The memory orders are accepted and ignored.
+ */
+template<typename V>
+class plain_atomic
+{
+public:
+    constexpr plain_atomic(V value) noexcept : value_(value) {}
+
+    constexpr auto load(std::memory_order = {}) const noexcept -> V
+    {
+        return value_;
+    }
+
+    constexpr void store(V value, std::memory_order = {}) noexcept
+    {
+        value_ = value;
+    }
+
+    constexpr auto compare_exchange_strong(V& expected,
+                                           V desired,
+                                           std::memory_order = {},
+                                           std::memory_order = {}) noexcept -> bool
+    {
+        if(value_ == expected) {
+            value_ = desired;
+            return true;
+        }
+        expected = value_;
+        return false;
+    }
+
+    constexpr auto compare_exchange_weak(V& expected,
+                                         V desired,
+                                         std::memory_order = {},
+                                         std::memory_order = {}) noexcept -> bool
+    {
+        return compare_exchange_strong(expected, desired);
+    }
+
+    constexpr auto exchange(V value, std::memory_order = {}) noexcept -> V
+    {
+        auto old = value_;
+        value_ = value;
+        return old;
+    }
+
+    constexpr auto fetch_add(V value, std::memory_order = {}) noexcept -> V
+    {
+        auto old = value_;
+        value_ += value;
+        return old;
+    }
+
+    constexpr auto fetch_sub(V value, std::memory_order = {}) noexcept -> V
+    {
+        auto old = value_;
+        value_ -= value;
+        return old;
+    }
+
+private:
+    V value_;
+};
+
+// Drop-in for std::atomic_ref that is only ever accessed by a single thread.
+template<typename V>
+class plain_atomic_ref
+{
+public:
+    constexpr explicit plain_atomic_ref(V& ref) noexcept : ref_(ref) {}
+
+    constexpr auto load(std::memory_order = {}) const noexcept -> V
+    {
+        return ref_;
+    }
+
+    constexpr void store(V value, std::memory_order = {}) noexcept
+    {
+        ref_ = value;
+    }
+
+    constexpr auto fetch_or(V value, std::memory_order = {}) noexcept -> V
+    {
+        auto old = ref_;
+        ref_ |= value;
+        return old;
+    }
+
+private:
+    V& ref_;
+};
+
+// mutex for policies that do not need mutual exclusion
+struct null_mutex
+{
+    constexpr void lock() noexcept {}
+    constexpr auto try_lock() noexcept -> bool { return true; }
+    constexpr void unlock() noexcept {}
+};
+
+// short critical sections between producers, never blocks in the kernel
+class spin_mutex
+{
+public:
+    void lock() noexcept
+    {
+        while(flag_.test_and_set(std::memory_order_acquire)) {
+            while(flag_.test(std::memory_order_relaxed)) {
+            }
+        }
+    }
+
+    auto try_lock() noexcept -> bool
+    {
+        return not flag_.test_and_set(std::memory_order_acquire);
+    }
+
+    void unlock() noexcept { flag_.clear(std::memory_order_release); }
+
+private:
+    std::atomic_flag flag_;
+};
+
+} // namespace detail
+} // namespace messagecache
@@ -8,90 +8,107 @@
 namespace messagecache {
 
 
-template<std::size_t SIZE>
-class coro_cache : protected ring_buffer<SIZE>
+template<std::size_t SIZE, typename Policy = concurrency::mpmc>
+class coro_cache : protected ring_buffer<SIZE, Policy>
 {
+    using base_slot = typename ring_buffer<SIZE, Policy>::slot;
+
+    struct alloc_awaiter;
+
 public:
-    using T = ring_buffer<SIZE>::T;
+    using T = ring_buffer<SIZE, Policy>::T;
+    using offset_type = ring_buffer<SIZE, Policy>::offset_type;
 
     /**
      * A slot takes ownership over a sequence of bytes in the cache.
      * While a caller holds its slot, the data will not be erased from the cache.
      * As soon as the slot is destroyed, the cache may reuse the storage.
      */
-    class slot : protected ring_buffer<SIZE>::slot
+    class slot : protected base_slot
     {
     private:
         friend coro_cache;
 
     public:
-        constexpr slot() noexcept : ring_buffer<SIZE>::slot() {}
+        constexpr slot() noexcept : base_slot(), cache_(nullptr) {}
 
-        constexpr slot(coro_cache& buffer, T* start, std::size_t size)
-            : ring_buffer<SIZE>::slot(buffer, start, size), cache_(buffer)
+        constexpr slot(coro_cache& buffer, offset_type start, std::size_t size)
+            : base_slot(buffer, start, size), cache_(std::addressof(buffer))
+        {}
+
+        constexpr slot(coro_cache& buffer, base_slot&& other) noexcept
+            : base_slot(std::move(other)), cache_(std::addressof(buffer))
         {}
 
         // move only
         constexpr slot(slot&&) noexcept = default;
-        constexpr auto operator=(slot&&) noexcept -> slot& = default;
+        constexpr auto operator=(slot&& other) noexcept -> slot&
+        {
+            if(this != std::addressof(other)) {
+                release();
+                base_slot::operator=(std::move(other));
+                cache_ = other.cache_;
+            }
+            return *this;
+        }
 
         constexpr slot(const slot&) noexcept = delete;
         constexpr auto operator=(const slot&) noexcept -> slot& = delete;
 
-        // implicit downcast-conversion
-        constexpr slot(ring_buffer<SIZE>::slot&& other) noexcept
-            : ring_buffer<SIZE>::slot(std::move(other))
-        {}
-
         ~slot() noexcept
         {
             release();
         }
 
+        using base_slot::valid;
+        using base_slot::operator bool;
+        using base_slot::begin;
+        using base_slot::cbegin;
+        using base_slot::end;
+        using base_slot::cend;
+        using base_slot::asSpan;
+        using base_slot::asMutableSpan;
+        using base_slot::flush;
+        using base_slot::synchronize;
+
         void release()
         {
-            // release the underlying slot
-            this->ring_buffer<SIZE>::slot::release();
+            if(not this->valid()) {
+                return;
+            }
 
-            // a slot was released, try to dequeue an awaiter
-            std::unique_lock<std::mutex> lock(cache_.mtx_);
+            // release the underlying slot
+            this->base_slot::release();
 
-            // iterate over all awaiters and try to allocate
-            alloc_awaiter* current = cache_.first_;
-
-            while(current) {
-                if(current->try_alloc()) {
-                    // the first slot was able to allocate, remove it from the list of awaiters.
-                    cache_.first_ = current->next_;
-                    current->handle_.resume();
-                    current = cache_.first_;
-                }
-                else {
-                    return; // allocation failed, stop trying
-                }
-            }
-            if(not cache_.first_) {
-                cache_.last_ = nullptr;
-            }
+            // a slot was released, try to dequeue awaiters
+            cache_->resumeAwaiters();
         }
     private:
-        coro_cache& cache_;
+        coro_cache* cache_;
     };
 
 
-    // asynchronously attempt to allocate a new buffer slot with the given size
-    auto alloc(std::size_t slot_size) noexcept
+    /**
+     * Asynchronously attempt to allocate a new buffer slot with the given size.
+     * High priority allocations may use the capacity set aside by reserve(),
+     * and they are woken before all normal priority awaiters.
+     */
+    auto alloc(std::size_t slot_size, priority prio = priority::normal) noexcept
     {
-        return alloc_awaiter{*this, slot_size};
+        return alloc_awaiter{*this, slot_size, prio};
     }
+
+    using ring_buffer<SIZE, Policy>::reserve;
+    using ring_buffer<SIZE, Policy>::set_overflow;
+    using ring_buffer<SIZE, Policy>::overflow_rings;
 private:
 
     struct alloc_awaiter {
         friend class coro_cache;
         friend class coro_cache::slot;
 
-        alloc_awaiter(coro_cache& cache, std::size_t size)
-            : cache_(cache), size_(size)
+        alloc_awaiter(coro_cache& cache, std::size_t size, priority prio)
+            : cache_(cache), size_(size), prio_(prio)
         {}
 
         auto await_ready() -> bool
@@ -104,15 +121,32 @@ private:
             // store the handle
             handle_ = h;
 
-            std::unique_lock<std::mutex> lock(cache_.mtx_);
-            if(cache_.last_) {
+            std::unique_lock lock(cache_.mtx_);
+            if(prio_ == priority::high) {
+                // high priority awaiters overtake all normal priority awaiters
+                auto** pos = &cache_.first_;
+                while(*pos and (*pos)->prio_ == priority::high) {
+                    pos = &(*pos)->next_;
+                }
+
+                if(pos == &cache_.first_ and this->try_alloc()) {
+                    return false; // no high priority awaiter in front, do not suspend
+                }
+
+                next_ = *pos;
+                *pos = this;
+                if(not next_) {
+                    cache_.last_ = this;
+                }
+            }
+            else if(cache_.last_) {
                 // append *this to the waiter list
                 cache_.last_->next_ = this;
                 cache_.last_ = this;
             }
             else {
                 // *this is the first awaiter.
-                assert(cache_.first_ = nullptr);
+                assert(cache_.first_ == nullptr);
 
                 // try to allocate a slot
                 if(this->try_alloc()) {
@@ -128,21 +162,21 @@ private:
         }
 
         auto await_resume() -> slot {
-            ret_ = cache_.ring_buffer<SIZE>::try_alloc(size_);
-
             assert(ret_ && "alloc_awaiter woke up too early.");
-            return ret_;
+            return std::move(ret_);
         }
     private:
         auto try_alloc() noexcept -> bool
         {
             // try to allocate a slot
-            ret_ = cache_.try_alloc(size_);
-            return ret_;
+            ret_ = slot{cache_,
+                        cache_.ring_buffer<SIZE, Policy>::try_alloc(size_, prio_)};
+            return ret_.valid();
         }
 
         coro_cache& cache_;
         std::size_t size_;
+        priority prio_;
         slot ret_;
 
         alloc_awaiter* next_ = nullptr;
@@ -150,9 +184,39 @@ private:
         std::coroutine_handle<> handle_ = nullptr;
     };
 
+    void resumeAwaiters()
+    {
+        alloc_awaiter* ready = nullptr;
+        {
+            std::unique_lock lock(mtx_);
+
+            // iterate over all awaiters and try to allocate
+            alloc_awaiter** tail = &ready;
+            while(first_ and first_->try_alloc()) {
+                // the first awaiter was able to allocate, remove it from the list
+                *tail = first_;
+                tail = &first_->next_;
+                first_ = first_->next_;
+                *tail = nullptr;
+            }
+            if(not first_) {
+                last_ = nullptr;
+            }
+        }
+
+        // resume outside of the lock, the awaiters may release slots right away
+        while(ready) {
+            auto* current = ready;
+            ready = ready->next_;
+            current->handle_.resume();
+        }
+    }
+
     alloc_awaiter* first_ = nullptr;
     alloc_awaiter* last_ = nullptr;
     // this mutex protects against concurrent modifications of first and last
-    std::mutex mtx_;
+    using mutex_type =
+        std::conditional_t<Policy::concurrent, std::mutex, detail::null_mutex>;
+    mutex_type mtx_;
 };
-} // namespace messagecache
\ No newline at end of file
+} // namespace messagecache
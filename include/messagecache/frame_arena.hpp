@@ -0,0 +1,214 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <new>
+
+#include <messagecache/ring_buffer.hpp>
+
+namespace messagecache {
+
+template<typename Arena>
+struct arena_frame;
+
+/**
+ * Ring of coroutine frames and other short-lived state, e.g. the handler state of
+ * asynchronous operations. Such blocks are mostly released in the order they were
+ * created, which is the pattern the ring is made for.
+ * Blocks that do not fit into a slot, or that arrive while the ring is full, are
+ * taken from the global heap. Each block remembers where it came from, deallocate()
+ * needs no reference to the arena.
+ *
+ * Coroutines take their frames from an arena if their promise type derives from
+ * arena_frame and they get the arena passed behind std::allocator_arg:
+ *
+ *     auto session(std::allocator_arg_t, frame_arena<65536>&, ...) -> task;
+ *
+ * Awaiters such as coro_cache's alloc_awaiter are part of the awaiting coroutine's
+ * frame, they are only placed in the arena along with an arena_frame. Coroutines
+ * on asio::awaitable are not covered: asio allocates their frames itself, and the
+ * promise type behind use_awaitable cannot be replaced. Their handler state can be
+ * placed in the arena by binding allocator<T> to the handler.
+ */
+template<std::size_t SIZE, typename Policy = concurrency::mpmc>
+class frame_arena : private ring_buffer<SIZE, Policy>
+{
+    using ring_type = ring_buffer<SIZE, Policy>;
+
+    // precedes every block, an invalid slot marks blocks from the heap
+    struct block_header
+    {
+        typename ring_type::slot storage;
+    };
+
+public:
+    using T = std::byte;
+
+    // alignment of all blocks, the same as the one of ::operator new
+    constexpr static std::size_t ALIGNMENT = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+
+    /**
+     * std::allocator compatible view of an arena.
+     * Binding it to the handler of an asynchronous operation, e.g. with
+     * asio::bind_allocator(), places the operation's state in the arena.
+     */
+    template<typename V>
+    class allocator
+    {
+    public:
+        using value_type = V;
+
+        static_assert(alignof(V) <= ALIGNMENT, "over-aligned types are not supported");
+
+        constexpr explicit allocator(frame_arena& arena) noexcept
+            : arena_(std::addressof(arena))
+        {}
+
+        template<typename U>
+        constexpr allocator(const allocator<U>& other) noexcept : arena_(other.arena_)
+        {}
+
+        auto allocate(std::size_t n) -> V*
+        {
+            if(n > std::numeric_limits<std::size_t>::max() / sizeof(V)) {
+                throw std::bad_array_new_length();
+            }
+            return static_cast<V*>(arena_->allocate(n * sizeof(V)));
+        }
+
+        void deallocate(V* ptr, std::size_t) noexcept { frame_arena::deallocate(ptr); }
+
+        template<typename U>
+        constexpr auto operator==(const allocator<U>& other) const noexcept -> bool
+        {
+            return arena_ == other.arena_;
+        }
+
+    private:
+        template<typename U>
+        friend class allocator;
+
+        frame_arena* arena_;
+    };
+
+    frame_arena() = default;
+
+    frame_arena(const frame_arena&) = delete;
+    auto operator=(const frame_arena&) -> frame_arena& = delete;
+
+    auto get_allocator() noexcept -> allocator<T> { return allocator<T>{*this}; }
+
+    /**
+     * Returns a block of at least size bytes, aligned to ALIGNMENT.
+     * Falls back to the global heap, throws std::bad_alloc like ::operator new.
+     */
+    auto allocate(std::size_t size) -> void*
+    {
+        if(size <= MAX_BLOCK_SIZE) {
+            // the slot's data is only aligned to the ring's header
+            auto region = this->try_alloc(size + HEADER_SPACE + ALIGNMENT);
+            if(region) {
+                auto* ptr = align(region.begin());
+                ::new(headerOf(ptr)) block_header{std::move(region)};
+                return ptr;
+            }
+        }
+        return allocateHeap(size);
+    }
+
+    // returns a block to the arena it was allocated from, or to the heap
+    static void deallocate(void* ptr) noexcept
+    {
+        if(not ptr) {
+            return;
+        }
+
+        auto* header = headerOf(ptr);
+        if(header->storage) {
+            auto storage = std::move(header->storage);
+            header->~block_header();
+            // storage goes out of scope and releases the block's slot
+        } else {
+            header->~block_header();
+            ::operator delete(static_cast<T*>(ptr) - HEADER_SPACE,
+                              std::align_val_t{ALIGNMENT});
+        }
+    }
+
+    using ring_type::occupancy;
+    using ring_type::reclaim;
+
+private:
+    template<typename Arena>
+    friend struct arena_frame;
+
+    // the header is placed right in front of the block, keeping its alignment
+    constexpr static std::size_t HEADER_SPACE =
+        (sizeof(block_header) + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+
+    constexpr static std::size_t MAX_BLOCK_SIZE =
+        std::numeric_limits<std::uint16_t>::max() - HEADER_SPACE - ALIGNMENT;
+
+    static auto align(T* begin) noexcept -> T*
+    {
+        auto const address = reinterpret_cast<std::uintptr_t>(begin) + HEADER_SPACE;
+        auto const aligned = (address + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+        return begin + (aligned - reinterpret_cast<std::uintptr_t>(begin));
+    }
+
+    static auto headerOf(void* ptr) noexcept -> block_header*
+    {
+        return reinterpret_cast<block_header*>(static_cast<T*>(ptr) - HEADER_SPACE);
+    }
+
+    static auto allocateHeap(std::size_t size) -> void*
+    {
+        auto* raw = static_cast<T*>(
+            ::operator new(size + HEADER_SPACE, std::align_val_t{ALIGNMENT}));
+        auto* ptr = raw + HEADER_SPACE;
+        ::new(headerOf(ptr)) block_header{};
+        return ptr;
+    }
+};
+
+/**
+ * Base for promise types whose coroutine frames are allocated from a frame_arena.
+ * The arena is passed as the argument behind std::allocator_arg, which is either
+ * the first argument or, for member functions, the first argument behind the
+ * object. Coroutines without an arena allocate their frames from the heap.
+ * Without optimization, GCC reports -Wmismatched-new-delete for these coroutines. It
+ * pairs a template operator new only with a template operator delete, which the
+ * language does not allow for frames. Suppress it around their definitions.
+ */
+template<typename Arena>
+struct arena_frame
+{
+    template<typename... Args>
+    static auto operator new(std::size_t size,
+                             std::allocator_arg_t,
+                             Arena& arena,
+                             Args&&...) -> void*
+    {
+        return arena.allocate(size);
+    }
+
+    template<typename Self, typename... Args>
+    static auto operator new(std::size_t size,
+                             Self&,
+                             std::allocator_arg_t,
+                             Arena& arena,
+                             Args&&...) -> void*
+    {
+        return arena.allocate(size);
+    }
+
+    static auto operator new(std::size_t size) -> void*
+    {
+        return Arena::allocateHeap(size);
+    }
+
+    static void operator delete(void* ptr) noexcept { Arena::deallocate(ptr); }
+};
+} // namespace messagecache
@@ -1,55 +1,131 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <atomic>
 #include <cassert>
 #include <cstdint>
 #include <iomanip>
 #include <iostream>
+#include <limits>
 #include <memory>
+#include <mutex>
 #include <span>
+#include <sstream>
+#include <type_traits>
+#include <vector>
+
+#include <messagecache/concurrency.hpp>
+#include <messagecache/tracing.hpp>
 
 namespace messagecache {
 
+/**
+ * Tag type for accessors that are called from the thread that filled the slot.
+ * Such accesses need no inter-thread synchronization and skip it entirely.
+ */
+struct same_thread_t
+{
+    explicit same_thread_t() = default;
+};
+inline constexpr same_thread_t same_thread{};
+
+/**
+ * Allocations with high priority may use the capacity that is reserved
+ * for them, see ring_buffer::reserve().
+ */
+enum class priority : std::uint8_t
+{
+    normal,
+    high
+};
+
 /**
  * Ringbuffer implementation that allocates once at initialization time.
  * Does not reallocate at runtime.
  * Allows the caller to allocate slots of any size in the buffer.
  * Slots represent contiguous memory regions that can be used arbitrarily
  * while the slot object is alive.
+ * The Policy (see concurrency.hpp) states which threads allocate and release
+ * slots and selects the cheapest synchronization that supports this.
  */
-template<std::size_t SIZE, typename Allocator = std::allocator<std::byte>>
+template<std::size_t SIZE,
+         typename Policy = concurrency::mpmc,
+         typename Allocator = std::allocator<std::byte>>
 class ring_buffer : private Allocator
 {
-    constexpr static std::size_t HEADER_LEN = 4;
+    /**
+     * Every slot is preceded by a header of two 16-bit words:
+     * the length of the slot and its state.
+     * The state word is the only location that is shared between the threads
+     * that fill, read and release a slot. Slots are padded to HEADER_ALIGN bytes
+     * so that the state word is suitably aligned for atomic accesses.
+     * With tracing enabled, the header continues with the 64-bit timestamps of the
+     * slot's allocation and its first flush, see tracing.hpp.
+     */
+    constexpr static std::size_t HEADER_LEN = tracing::enabled ? 24 : 4;
+    constexpr static std::size_t HEADER_ALIGN =
+        tracing::enabled ? alignof(std::uint64_t) : alignof(std::uint16_t);
+    constexpr static std::size_t ALLOC_TIME = 8;
+    constexpr static std::size_t FLUSH_TIME = 16;
+
+    using state_type = std::uint16_t;
+    static_assert(std::atomic_ref<state_type>::required_alignment <= HEADER_ALIGN);
+
+    constexpr static state_type SLOT_IN_USE = 0;
+    constexpr static state_type SLOT_PUBLISHED = 1;
+    // set next to SLOT_PUBLISHED once the handoff of a traced slot is recorded
+    constexpr static state_type SLOT_CONSUMED = 2;
+    constexpr static state_type SLOT_UNUSED = 0b1111'1111'1111'1111;
 
 public:
     using T = std::byte;
 
     using value_type = T;
+    using policy_type = Policy;
     using allocator_traits = std::allocator_traits<Allocator>;
     using size_type = typename allocator_traits::size_type;
 
+    /**
+     * Cursors and slots address the buffer by offsets relative to its begin.
+     * Rings below 4 GiB get away with 32-bit offsets, which keeps the slot
+     * handles small and makes the cursor state independent of the buffer's address.
+     */
+    using offset_type = std::conditional_t<
+        (SIZE + HEADER_LEN <= std::numeric_limits<std::uint32_t>::max()),
+        std::uint32_t,
+        std::uint64_t>;
+
     constexpr ring_buffer()
         : raw_ptr_(allocator_traits::allocate(*this, SIZE + HEADER_LEN)),
-          raw_(raw_ptr_, SIZE + HEADER_LEN),
-          write_ptr_(raw_.data()),
-          free_ptr_(raw_.data())
+          write_ptr_(0),
+          free_ptr_(0)
     {}
 
-    ~ring_buffer() noexcept {
-        allocator_traits::deallocate(*this, raw_ptr_, SIZE + HEADER_LEN);
+    ~ring_buffer() noexcept
+    {
+        if(raw_ptr_) {
+            allocator_traits::deallocate(*this, raw_ptr_, SIZE + HEADER_LEN);
+        }
     };
 
+    // offsets stay valid when the storage changes hands, no fix-ups required
     constexpr ring_buffer(ring_buffer&& other) noexcept
         : raw_ptr_(other.raw_ptr_),
-          raw_(raw_ptr_, SIZE + HEADER_LEN),
+          release_hook_(other.release_hook_),
+          reserved_(other.reserved_),
+          overflow_(std::move(other.overflow_)),
+          overflow_limit_(other.overflow_limit_),
+          overflow_kept_(other.overflow_kept_),
           write_ptr_(other.write_ptr_.load(std::memory_order_seq_cst)),
           free_ptr_(other.free_ptr_.load(std::memory_order_seq_cst))
     {
         other.raw_ptr_ = nullptr;
-        // other.raw_ = decltype(raw_){0, raw_.size()};
     }
 
+    template<std::size_t LIMIT>
+    class release_batch;
+
     /**
      * A slot takes ownership over a sequence of bytes in the ring buffer.
      * While a caller holds its slot, the data will not be erased from the ring buffer.
@@ -61,20 +137,24 @@ public:
     {
     protected:
         friend ring_buffer;
+        template<std::size_t LIMIT>
+        friend class release_batch;
 
         /**
          * @param buffer the corresponding buffer
-         * @param start  the start pointer of the slot. that is *start is the size of the
-         * slot
+         * @param start  the offset of the slot within the buffer. that is, the slot's
+         * header is located at start
          * @param size   the size of the slot.
          */
-        constexpr slot(ring_buffer& buffer, T* start, std::size_t size) noexcept
-            : buf_(std::addressof(buffer)), start_(start), size_(size)
+        constexpr slot(ring_buffer& buffer, offset_type start, std::size_t size) noexcept
+            : buf_(std::addressof(buffer)),
+              start_(start),
+              size_(static_cast<std::uint16_t>(size))
         {}
 
     public:
         // default-constructed slot points to invalid memory region
-        constexpr slot() noexcept : buf_(nullptr), start_(nullptr), size_(0) {}
+        constexpr slot() noexcept : buf_(nullptr), start_(0), size_(0) {}
 
         // delete copy
         constexpr slot(const slot&) = delete;
@@ -84,11 +164,13 @@ public:
         constexpr auto operator=(slot&& other) noexcept -> slot&
         {
             if(this != std::addressof(other)) {
+                release();
+
                 buf_ = other.buf_;
                 start_ = other.start_;
                 size_ = other.size_;
 
-                other.start_ = nullptr;
+                other.buf_ = nullptr;
                 other.size_ = 0;
             }
             return *this;
@@ -96,7 +178,7 @@ public:
         constexpr slot(slot&& other) noexcept
             : buf_(other.buf_), start_(other.start_), size_(other.size_)
         {
-            other.start_ = nullptr;
+            other.buf_ = nullptr;
             other.size_ = 0;
         }
 
@@ -104,10 +186,7 @@ public:
         constexpr ~slot() noexcept { release(); }
 
         // returns true if the slot points to a valid range of memory
-        constexpr auto valid() const noexcept -> bool
-        {
-            return start_ != nullptr and buf_ != nullptr;
-        }
+        constexpr auto valid() const noexcept -> bool { return buf_ != nullptr; }
 
         constexpr operator bool() const noexcept { return valid(); }
 
@@ -115,19 +194,42 @@ public:
         // Invalidates all iterators
         void release() noexcept
         {
-            if(start_) {
+            if(buf_) {
+                if constexpr(tracing::enabled) {
+                    tracing::record(tracing::event::residency,
+                                    buf_->timeAt(start_, ALLOC_TIME),
+                                    tracing::now());
+                }
+
+                // an overflow ring may be retired as soon as its last slot is
+                // discarded, do not touch it afterwards. Overflow rings have no hook.
+                auto hook = buf_->release_hook_;
                 discard();
 
-                start_ = nullptr;
+                if(hook) {
+                    hook(*buf_);
+                }
+
+                buf_ = nullptr;
                 size_ = 0;
             }
         }
 
+        /**
+         * Shrinks the memory region visible through the slot to the first size bytes,
+         * e.g. to the number of bytes a read filled in. The ring reclaims the whole
+         * region on release.
+         */
+        constexpr void shrink(std::size_t size) noexcept
+        {
+            assert(size <= size_);
+            size_ = static_cast<std::uint16_t>(size);
+        }
+
         constexpr auto begin() const noexcept -> T*
         {
-            // returns nullptr if start_ == nullptr,
-            // else start_ + HEADER_LEN
-            return start_ + (HEADER_LEN * (start_ != nullptr));
+            // returns nullptr for invalid slots
+            return buf_ ? buf_->at(start_) + HEADER_LEN : nullptr;
         }
 
         constexpr auto cbegin() const noexcept -> const T* { return begin(); }
@@ -144,46 +246,100 @@ public:
         constexpr auto asSpan() const -> std::span<const std::byte>
         {
             synchronize();
-            return {cbegin(), size_};
+            return asSpan(same_thread);
         }
 
         /**
          * Returns a read-only std::span that spans the slot's memory region.
+         * Skips synchronization, the caller must have filled the slot itself.
+         */
+        constexpr auto asSpan(same_thread_t) const noexcept -> std::span<const std::byte>
+        {
+            return {cbegin(), size_};
+        }
+
+        /**
+         * Returns a mutable std::span that spans the slot's memory region.
          * Ensures inter-thread synchronization on the buffer's region.
          * @return A std::span that can be used to read from the memory region
          */
         constexpr auto asMutableSpan() -> std::span<std::byte>
         {
             synchronize();
+            return asMutableSpan(same_thread);
+        }
+
+        /**
+         * Returns a mutable std::span that spans the slot's memory region.
+         * Skips synchronization, the caller must have filled the slot itself.
+         */
+        constexpr auto asMutableSpan(same_thread_t) noexcept -> std::span<std::byte>
+        {
             return {begin(), size_};
         }
 
         /**
          * Call flush() after modifications of the buffer's memory region.
-         * This ensures inter-thread synchronization on the buffer's region
+         * Publishes the modifications through the slot's header, a thread that
+         * calls synchronize() afterwards observes them.
+         * Not needed if the slot is only accessed by the thread that filled it.
          */
         void flush() noexcept
         {
-            std::atomic_thread_fence(std::memory_order_release);
-            std::atomic_store_explicit(&flag_, true, std::memory_order_release);
+            if(buf_) {
+                if constexpr(tracing::enabled) {
+                    // only the first flush is traced, consumers may read its time
+                    auto state = buf_->stateAt(start_);
+                    if(state.load(std::memory_order_relaxed) == SLOT_IN_USE) {
+                        auto const time = tracing::now();
+                        buf_->timeAt(start_, FLUSH_TIME) = time;
+                        tracing::record(
+                            tracing::event::fill, buf_->timeAt(start_, ALLOC_TIME), time);
+                    }
+                    // keeps SLOT_CONSUMED of a consumer that already synchronized
+                    state.fetch_or(SLOT_PUBLISHED, std::memory_order_release);
+                } else {
+                    buf_->stateAt(start_).store(SLOT_PUBLISHED,
+                                                std::memory_order_release);
+                }
+            }
         }
 
         /**
          * Call synchronize() before accessing buffer's memory region via the
-         * begin() or end() iterators. This ensures inter-thread synchronization
-         * on the buffer's region
+         * begin() or end() iterators. Acquires the modifications that were
+         * published by flush() on another thread.
+         * Returns false if the slot was not flushed yet.
          */
-        void synchronize() const noexcept
+        auto synchronize() const noexcept -> bool
         {
-            std::atomic_load_explicit(&flag_, std::memory_order_acquire);
-            std::atomic_thread_fence(std::memory_order_acquire);
+            if(buf_) {
+                auto state = buf_->stateAt(start_).load(std::memory_order_acquire);
+
+                // the first call after the first flush counts, a slot that was never
+                // flushed has no handoff
+                if constexpr(tracing::enabled) {
+                    if(state == SLOT_PUBLISHED) {
+                        auto const prev = buf_->stateAt(start_).fetch_or(
+                            SLOT_CONSUMED, std::memory_order_relaxed);
+                        if(not(prev & SLOT_CONSUMED)) {
+                            tracing::record(tracing::event::handoff,
+                                            buf_->timeAt(start_, FLUSH_TIME),
+                                            tracing::now());
+                        }
+                    }
+                }
+                return (state & SLOT_PUBLISHED) != 0;
+            }
+            return false;
         }
 
         void print() const
         {
             synchronize();
             std::stringstream ss;
-            const auto* ptr = reinterpret_cast<const unsigned char*>(start_);
+            const auto* ptr =
+                reinterpret_cast<const unsigned char*>(begin() - HEADER_LEN);
             for(std::size_t i = 0; i < size_ + HEADER_LEN; ++i) {
                 ss << std::hex << std::setw(2) << std::setfill('0')
                    << static_cast<int>(ptr[i]) << " ";
@@ -194,66 +350,445 @@ public:
     private:
         constexpr void discard()
         {
+            // the header holds the full length of the slot
+            auto const next = static_cast<offset_type>(start_ + lengthAt(buf_->at(start_))
+                                                       + HEADER_LEN);
+
             // OPTIMIZATION: try to advance the free pointer immediately if it points to
-            // the start of the current slot
-            auto* old_value = start_;
-            if(buf_->free_ptr_.compare_exchange_strong(old_value,
-                                                       start_ + size_ + HEADER_LEN,
-                                                       std::memory_order_release)) {
-                return;
+            // the start of the current slot, together with the slots behind it that
+            // were released out of order.
+            // The slot is still in use while we try, so no other slot can start at the
+            // same offset. Marking the slot first would allow the writer to reuse it
+            // before the exchange.
+            if(buf_->free_ptr_.load(std::memory_order_relaxed) == start_) {
+                if constexpr(Policy::multi_consumer) {
+                    auto old_value = start_;
+                    if(buf_->free_ptr_.compare_exchange_strong(
+                           old_value,
+                           buf_->skipUnused(next),
+                           std::memory_order_release,
+                           std::memory_order_relaxed)) {
+                        return;
+                    }
+                } else {
+                    // Only the owner of the slot at the free pointer may move it past
+                    // the slot, a single consumer gets away without the exchange.
+                    buf_->free_ptr_.store(buf_->skipUnused(next),
+                                          std::memory_order_release);
+                    return;
+                }
             }
 
             // mark the slot as OK to free.
-            auto* unused_flag = reinterpret_cast<std::uint16_t*>(start_ + 2);
-            *unused_flag = static_cast<std::uint16_t>(0b1111'1111'1111'1111);
-            buf_->flush();
+            // The release store hands the region back to the writer, which acquires it
+            // while searching for free slots.
+            buf_->stateAt(start_).store(SLOT_UNUSED, std::memory_order_release);
         }
 
     private:
         ring_buffer* buf_;
 
-        T* start_;
-        std::size_t
-            size_; // size of the slot visible to the application, *without* header
+        offset_type start_;
+        // size of the slot visible to the application, *without* header
+        std::uint16_t size_;
+    };
+
+    /**
+     * Collects the slots released by a consumer thread and hands them back to the
+     * ring at once, when the batch is full, on publish() or when it is destroyed.
+     * The slots are marked unused behind a single fence. If the batch holds the slot
+     * at the free cursor, the cursor then advances past it and the released slots
+     * behind it at once, e.g. past the run of a consumer draining the ring in FIFO
+     * order. Released slots stay occupied until the batch is published. A batch
+     * belongs to the thread that fills it.
+     */
+    template<std::size_t LIMIT = 64>
+    class release_batch
+    {
+    public:
+        static_assert(LIMIT > 0);
+
+        explicit release_batch(ring_buffer& buffer) noexcept
+            : buf_(std::addressof(buffer))
+        {}
+
+        release_batch(const release_batch&) = delete;
+        auto operator=(const release_batch&) -> release_batch& = delete;
+
+        ~release_batch() noexcept { publish(); }
+
+        // Takes over the slot's region, the slot is invalid afterwards.
+        void release(slot&& s) noexcept
+        {
+            if(s.buf_ != buf_) {
+                // invalid, or allocated from an overflow ring
+                s.release();
+                return;
+            }
+
+            if constexpr(tracing::enabled) {
+                tracing::record(tracing::event::residency,
+                                buf_->timeAt(s.start_, ALLOC_TIME),
+                                tracing::now());
+            }
+
+            pending_[count_++] = s.start_;
+            s.buf_ = nullptr;
+            s.size_ = 0;
+
+            if(count_ == LIMIT) {
+                publish();
+            }
+        }
+
+        // returns the number of slots that wait to be published
+        auto size() const noexcept -> std::size_t { return count_; }
+
+        // hands all collected slots back to the ring
+        void publish() noexcept
+        {
+            if(count_ == 0) {
+                return;
+            }
 
-        std::atomic_bool flag_;
+            // The slots are still in use, the free cursor cannot move past the
+            // one it points to. Keep that one for last.
+            auto const fp = buf_->free_ptr_.load(std::memory_order_relaxed);
+            auto const first = std::find(pending_.begin(), pending_.begin() + count_, fp);
+            bool const at_cursor = first != pending_.begin() + count_;
+            if(at_cursor) {
+                std::iter_swap(first, pending_.begin() + count_ - 1);
+            }
+
+            // the others are marked first, the cursor advance passes them if they
+            // follow the slot at the cursor
+            markUnused(0, at_cursor ? count_ - 1 : count_);
+
+            if(at_cursor) {
+                auto const end = buf_->skipUnused(
+                    static_cast<offset_type>(fp + lengthAt(buf_->at(fp)) + HEADER_LEN));
+                if constexpr(Policy::multi_consumer) {
+                    auto expected = fp;
+                    if(not buf_->free_ptr_.compare_exchange_strong(
+                           expected,
+                           end,
+                           std::memory_order_release,
+                           std::memory_order_relaxed)) {
+                        markUnused(count_ - 1, count_);
+                    }
+                } else {
+                    buf_->free_ptr_.store(end, std::memory_order_release);
+                }
+            }
+            count_ = 0;
+
+            if(auto hook = buf_->release_hook_) {
+                hook(*buf_);
+            }
+        }
+
+    private:
+        void markUnused(std::size_t first, std::size_t last) noexcept
+        {
+            if(first == last) {
+                return;
+            }
+
+            // one fence hands all regions back to the writer, which acquires
+            // them while searching for free slots
+            constexpr auto order = detail::fences_supported ? std::memory_order_relaxed
+                                                            : std::memory_order_release;
+            if constexpr(Policy::concurrent and detail::fences_supported) {
+                std::atomic_thread_fence(std::memory_order_release);
+            }
+            for(auto i = first; i < last; ++i) {
+                buf_->stateAt(pending_[i]).store(SLOT_UNUSED, order);
+            }
+        }
+
+        ring_buffer* buf_;
+        std::size_t count_ = 0;
+        std::array<offset_type, LIMIT> pending_;
     };
 
-    // try to allocate a slot of the given size
-    auto try_alloc(std::size_t slot_size) noexcept -> slot
+    /**
+     * Try to allocate a slot of the given size.
+     * Falls back to the overflow rings if the ring is full, see set_overflow().
+     */
+    auto try_alloc(std::size_t slot_size, priority prio = priority::normal) noexcept
+        -> slot
+    {
+        std::unique_lock lock(alloc_mtx_);
+        auto ret = allocate(slot_size, prio);
+        lock.unlock();
+
+        if constexpr(Policy::multi_producer and detail::fences_supported) {
+            // a release found the lock taken and left the reclaim to this thread
+            if(reclaimPending() and release_hook_) {
+                release_hook_(*this);
+            }
+        }
+        return ret;
+    }
+
+    /**
+     * Enables the elastic mode: instead of failing when the ring is full, allocations
+     * are served from up to limit overflow rings of the same size. preallocated of
+     * them are allocated right away and kept, the others are allocated when needed
+     * and retired once they drained. The ring itself is preferred as soon as it has
+     * room again.
+     * Slots release back to the ring that owns them. occupancy(), reclaim(),
+     * release batches and release hooks only cover the ring itself.
+     * Allocating an overflow ring allocates memory while the producers are locked
+     * out. Not thread-safe, configure before using the ring.
+     */
+    void set_overflow(std::size_t limit, std::size_t preallocated = 0)
+    {
+        assert(preallocated <= limit);
+
+        overflow_limit_ = limit;
+        overflow_kept_ = preallocated;
+        overflow_.clear();
+        overflow_.reserve(limit);
+        while(overflow_.size() < preallocated) {
+            addOverflow();
+        }
+    }
+
+    // returns the number of overflow rings that are currently allocated
+    auto overflow_rings() const noexcept -> std::size_t { return overflow_.size(); }
+
+    // size of the storage in bytes, including slot headers
+    constexpr static auto capacity() noexcept -> std::size_t { return END; }
+
+    // the space a slot of data_size bytes takes in the ring, header and padding
+    constexpr static auto footprint(std::size_t data_size) noexcept -> std::size_t
     {
-        auto* start = getNextWritePointer(slot_size);
-        if(start) {
+        return (data_size + HEADER_LEN + HEADER_ALIGN - 1) & ~(HEADER_ALIGN - 1);
+    }
+
+    /**
+     * Returns the largest slot size try_alloc() can hand out with the given priority,
+     * once the ring drained. Larger allocations always fail.
+     */
+    auto max_slot_size(priority prio = priority::normal) const noexcept -> std::size_t
+    {
+        auto const headroom = prio == priority::high ? 0 : reserved_;
+        auto const limit = std::min(END - std::min<std::size_t>(headroom, END),
+                                    MAX_SLOT_SIZE + HEADER_LEN);
+        auto const max_footprint = limit & ~(HEADER_ALIGN - 1);
+        return max_footprint > HEADER_LEN ? max_footprint - HEADER_LEN : 0;
+    }
+
+    /**
+     * Keeps room for a high priority slot of slot_size bytes.
+     * Normal allocations fail rather than taking the reserved capacity, so that a
+     * high priority allocation of up to slot_size bytes succeeds even if normal
+     * allocations filled the ring. Reserve the sum of the sizes if several high
+     * priority slots must be guaranteed at the same time.
+     * Like any region of the ring, the reserved capacity used by a high priority slot
+     * becomes available again once the slots in front of it were released.
+     * Not thread-safe, reserve before using the ring.
+     */
+    void reserve(std::size_t slot_size) noexcept
+    {
+        reserved_ = slot_size ? footprint(slot_size) : 0;
+        for(auto& ring : overflow_) {
+            ring->reserved_ = reserved_;
+        }
+    }
+
+    /**
+     * Returns the number of bytes between the free and the write cursor, including
+     * slot headers. Derived from the cursors only, slots that were released out of
+     * order count until the free cursor passes them. See reclaim().
+     */
+    auto occupancy() const noexcept -> std::size_t
+    {
+        auto const wp = write_ptr_.load(std::memory_order_relaxed);
+        auto const fp = free_ptr_.load(std::memory_order_relaxed);
+
+        if(wp < fp) {
+            // the unused tail behind the last slot counts as occupied
+            return END - fp + wp;
+        }
+        return wp - fp;
+    }
+
+    /**
+     * Advances the free cursor past slots that were released out of order.
+     * Allocations do this on their own, and so does the release of the slot at the
+     * free cursor. With several consumers, the slot at the cursor may be released out
+     * of order while the cursor moves onto it; releasing threads call reclaim() to get
+     * an up to date occupancy() then.
+     * Only tries the producer lock: if another thread holds it, that thread reclaims
+     * once it unlocks and a producer invokes the release hook on behalf of the caller.
+     * A no-op for policies with a single producer on another thread, only the producer
+     * may move the cursors then.
+     */
+    void reclaim() noexcept
+    {
+        if constexpr(not Policy::concurrent) {
+            updateFreePtr();
+        } else if constexpr(Policy::multi_producer and detail::fences_supported) {
+            // publishes the releases that happened before, see reclaimPending()
+            reclaim_pending_.store(true, std::memory_order_release);
+            reclaimPending();
+        } else if constexpr(Policy::multi_producer) {
+            std::lock_guard lock(alloc_mtx_);
+            updateFreePtr();
+        }
+    }
+
+protected:
+    // invoked after a slot of this ring was released, by the releasing thread, or by a
+    // producer that reclaimed on behalf of the releasing thread, see reclaim()
+    using release_hook = void (*)(ring_buffer&) noexcept;
+
+    void setReleaseHook(release_hook hook) noexcept { release_hook_ = hook; }
+
+private:
+    // marks a failed allocation
+    constexpr static offset_type npos = std::numeric_limits<offset_type>::max();
+
+    auto allocate(std::size_t slot_size, priority prio) noexcept -> slot
+    {
+        auto const headroom = prio == priority::high ? 0 : reserved_;
+        auto start = getNextWriteOffset(slot_size, headroom);
+        if(start != npos) {
+            if(overflow_.size() > overflow_kept_) {
+                retireOverflow();
+            }
             return slot{*this, start, slot_size};
         }
+        if(overflow_limit_ != 0) {
+            return allocOverflow(slot_size, prio);
+        }
         return {}; // default-constructed slot points to nullptr memory region
     }
 
-private:
+    /**
+     * Runs the reclaims requested while another thread held the producer lock, call
+     * it after unlocking. Returns true if it reclaimed.
+     * Pairs with the fence of the requesting thread: either this thread sees the
+     * request, or the requesting thread sees the lock released and takes it itself.
+     */
+    auto reclaimPending() noexcept -> bool
+    {
+        auto reclaimed = false;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        while(reclaim_pending_.load(std::memory_order_relaxed)
+              and alloc_mtx_.try_lock()) {
+            // acquires the releases of the requesting threads
+            reclaim_pending_.exchange(false, std::memory_order_acquire);
+            updateFreePtr();
+            alloc_mtx_.unlock();
+            reclaimed = true;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+        return reclaimed;
+    }
+
+    // the largest slot size that can be represented in a header
+    constexpr static std::size_t MAX_SLOT_SIZE =
+        std::numeric_limits<std::uint16_t>::max();
+
+    constexpr static offset_type END = SIZE + HEADER_LEN;
+
+    constexpr auto at(offset_type offset) const noexcept -> T*
+    {
+        return raw_ptr_ + offset;
+    }
+
     constexpr static auto lengthAt(T* const loc) noexcept -> std::size_t
     {
         auto* len_field = reinterpret_cast<std::uint16_t*>(loc);
         return *len_field;
     }
 
-    constexpr auto getLengthAndFlag(T* const start) noexcept
-        -> std::pair<std::size_t, bool>
+    using state_ref = std::conditional_t<Policy::concurrent,
+                                         std::atomic_ref<state_type>,
+                                         detail::plain_atomic_ref<state_type>>;
+
+    // the state word of the slot header at the given offset
+    auto stateAt(offset_type start) const noexcept -> state_ref
+    {
+        return state_ref(*reinterpret_cast<state_type*>(at(start) + 2));
+    }
+
+    // a timestamp in the header of the slot at the given offset, see tracing.hpp
+    auto timeAt(offset_type start, std::size_t field) const noexcept -> std::uint64_t&
+    {
+        return *reinterpret_cast<std::uint64_t*>(at(start) + field);
+    }
+
+    auto getLengthAndFlag(offset_type start) noexcept -> std::pair<std::size_t, bool>
     {
-        std::size_t length = lengthAt(start);
+        std::size_t length = lengthAt(at(start));
 
-        auto* unused_flag = reinterpret_cast<std::uint16_t*>(start + 2);
-        bool unused = (*unused_flag) > 0;
+        // acquire the slot's memory if it was released by another thread
+        bool unused = stateAt(start).load(std::memory_order_acquire) == SLOT_UNUSED;
 
         return {length, unused};
     }
 
-    constexpr auto updateFreePtr() noexcept
+    // Moves the free cursor from expected to desired.
+    // Fails if a releasing thread advanced the cursor in the meantime, its value is
+    // ahead of ours then.
+    auto advanceFreePtr(offset_type expected, offset_type desired) noexcept -> bool
     {
-        // synchronize memory to ensure we see updated slot flags
-        synchronize();
+        if constexpr(Policy::multi_consumer) {
+            return free_ptr_.compare_exchange_strong(
+                expected, desired, std::memory_order_relaxed, std::memory_order_relaxed);
+        } else {
+            // A single consumer only moves the cursor away from a slot that is
+            // still in use, i.e. when expected == desired. Skipping that store
+            // cannot lose its update.
+            if(expected != desired) {
+                free_ptr_.store(desired, std::memory_order_relaxed);
+            }
+            return true;
+        }
+    }
 
-        auto* const wp = write_ptr_.load(std::memory_order_relaxed);
-        auto* const fp = free_ptr_.load(std::memory_order_relaxed);
+    /**
+     * Returns the offset behind the run of released slots that starts at from, or
+     * from itself if that slot is in use.
+     * Called by the releasing thread while its slot keeps the free cursor in front of
+     * from. The writer cannot reuse any region behind the cursor in the meantime.
+     */
+    auto skipUnused(offset_type from) const noexcept -> offset_type
+    {
+        // synchronizes with the writer, all headers in front of it are visible
+        auto const wp = write_ptr_.load(std::memory_order_acquire);
+
+        auto i = from;
+        if(wp < i) {
+            // up to the end of the slots behind the free cursor, which the writer
+            // marked when it started over at the front
+            while(i < END - HEADER_LEN) {
+                if(stateAt(i).load(std::memory_order_acquire) != SLOT_UNUSED) {
+                    return i;
+                }
+                auto const length = lengthAt(at(i));
+                if(length == 0) {
+                    break; // the end marker
+                }
+                i = static_cast<offset_type>(i + length + HEADER_LEN);
+            }
+            i = 0;
+        }
+        while(i < wp and stateAt(i).load(std::memory_order_acquire) == SLOT_UNUSED) {
+            i = static_cast<offset_type>(i + lengthAt(at(i)) + HEADER_LEN);
+        }
+        return i;
+    }
+
+    auto updateFreePtr() noexcept
+    {
+        auto const wp = write_ptr_.load(std::memory_order_relaxed);
+        // synchronizes with releasing threads that advanced the cursor
+        auto const fp = free_ptr_.load(std::memory_order_acquire);
 
         // Linear search for next non-free slot
         if(wp < fp) {
@@ -262,7 +797,7 @@ private:
             //      xxxxxxxxxxx                    000
             // .(2).             .........(1).........
 
-            for(T* i = fp; i < raw_.data() + raw_.size() - HEADER_LEN;) {
+            for(offset_type i = fp; i < END - HEADER_LEN;) {
                 // case (1)
                 auto [length, unused] = getLengthAndFlag(i);
                 if(length == 0) {
@@ -272,19 +807,17 @@ private:
                 if(length > 0 and unused) {
                     i += length + HEADER_LEN;
                 } else {
-                    free_ptr_.store(i, std::memory_order_relaxed);
-                    // spdlog::debug("update wp<fp={}", i-raw_.data());
+                    advanceFreePtr(fp, i);
                     return;
                 }
             }
-            for(T* i = raw_.data(); i < wp;) {
+            for(offset_type i = 0; i < wp;) {
                 // case (2)
                 auto [length, unused] = getLengthAndFlag(i);
                 if(length > 0 and unused) {
                     i += length + HEADER_LEN;
                 } else {
-                    free_ptr_.store(i, std::memory_order_relaxed);
-                    // spdlog::debug("update wp<fp={}", i-raw_.data());
+                    advanceFreePtr(fp, i);
                     return;
                 }
             }
@@ -294,54 +827,52 @@ private:
             // [==== len,flag ==== ==== ==== ==== ====]
             //       fp            wp
             //  xxxxx              xxxxxxxxxxxxxxxxxxx
-            for(T* i = fp; i < wp;) {
+            for(offset_type i = fp; i < wp;) {
                 auto [length, unused] = getLengthAndFlag(i);
                 if(unused) {
                     i += length + HEADER_LEN;
                 } else {
-                    free_ptr_.store(i, std::memory_order_relaxed);
-                    // spdlog::debug("update fp {}->{}", fp-raw_.data(), i-raw_.data()/*,
-                    // active_slots_.load(std::memory_order_relaxed)*/);
+                    advanceFreePtr(fp, i);
                     return;
                 }
             }
         }
 
-        free_ptr_.store(raw_.data(), std::memory_order_relaxed);
-        write_ptr_.store(raw_.data(), std::memory_order_relaxed);
+        // all slots are unused, start over at the front
+        if(advanceFreePtr(fp, 0)) {
+            write_ptr_.store(0, std::memory_order_relaxed);
+        }
         return;
     }
 
 
     /**
-     * Returns a pointer to the next slot that has data_size many bytes available
+     * Returns the offset of the next slot that has data_size many bytes available
      * @param  data_size Size of the slot to reserve
-     * @return           Pointer to the begin of the slot
+     * @param  headroom  Contiguous space that has to remain available behind the slot
+     * @return           Offset of the begin of the slot, npos if there is no space
      */
-    auto getNextWritePointer(std::size_t data_size) noexcept -> T*
+    auto getNextWriteOffset(std::size_t data_size, std::size_t headroom) noexcept
+        -> offset_type
     {
-        std::size_t required_size = data_size + HEADER_LEN;
-        if(required_size > raw_.size()) {
-            return nullptr; // cannot allocate this many bytes.
+        std::size_t required_size = footprint(data_size);
+        if(required_size > END or required_size - HEADER_LEN > MAX_SLOT_SIZE) {
+            return npos; // cannot allocate this many bytes.
         }
-        assert(required_size <= raw_.size());
-
-        // TODO: This lock is only necessary for multiple consumers
-        // auto _ = mtx_.scopedLock();
+        assert(required_size <= END);
 
         updateFreePtr();
 
-        auto* const wp = write_ptr_.load(std::memory_order_relaxed);
-        auto* const fp = free_ptr_.load(std::memory_order_relaxed);
-
-        // spdlog::debug("new slot with fp{}, wp{}", fp - raw_.data(), wp - raw_.data());
+        auto const wp = write_ptr_.load(std::memory_order_relaxed);
+        auto const fp = free_ptr_.load(std::memory_order_acquire);
 
         if(wp == fp) {
             // buffer is empty
-            free_ptr_.store(raw_.data(), std::memory_order_relaxed);
-            write_ptr_.store(raw_.data() + required_size, std::memory_order_relaxed);
-            // spdlog::debug("(empty)");
-            return setLengthAt(raw_.data(), data_size);
+            if(required_size + headroom > END) {
+                return npos;
+            }
+            free_ptr_.store(0, std::memory_order_relaxed);
+            return commitSlot(0, required_size);
         }
         if(wp < fp) {
             // [==== ==== ==== ==== ==== ==== ====]
@@ -349,13 +880,10 @@ private:
             //      xxxxxxxxxx(slot in use)
 
             std::size_t size_avail_between = fp - wp;
-            if(required_size < size_avail_between) {
+            if(required_size + headroom < size_avail_between) {
                 // keep the free and write pointer separated while the ring buffer is
                 // non-empty
-                write_ptr_.store(wp + required_size);
-                // spdlog::debug("(2) getting slot wp{}, fp{}", wp-raw_.data(),
-                // fp-raw_.data());
-                return setLengthAt(wp, data_size);
+                return commitSlot(wp, required_size);
             }
         } else {
             // [==== ==== ==== ==== ==== ==== ====]
@@ -363,69 +891,130 @@ private:
             //  xxxxxx              xxxxxxxxxxxxxx
             //   (2)                    (1)
 
-            std::size_t size_avail_at_end = raw_.data() + raw_.size() - wp;
-            if(required_size <= size_avail_at_end) {
+            std::size_t size_avail_at_end = END - wp;
+            std::size_t size_avail_at_front = fp;
+            if(required_size <= size_avail_at_end
+               and (size_avail_at_end - required_size >= headroom
+                    or headroom < size_avail_at_front)) {
                 // (1)
-                write_ptr_.store(wp + required_size);
-                // spdlog::debug("(3) getting slot wp{}, fp{}", wp-raw_.data(),
-                // fp-raw_.data());
-                return setLengthAt(wp, data_size);
+                return commitSlot(wp, required_size);
             }
 
-            std::size_t size_avail_at_front = fp - raw_.data();
-            if(required_size < size_avail_at_front) {
+            if(required_size + headroom < size_avail_at_front) {
                 // keep the free and write pointer separated while the ring buffer is
                 // filled (2) ensure the end is zeroed to avoid buggy freeing near the end
-                std::fill(wp, raw_.data() + raw_.size(), static_cast<T>(0));
+                std::fill(at(wp), at(END), static_cast<T>(0));
+                if(wp < END - HEADER_LEN) {
+                    // releasing threads stop at the zero length, see skipUnused()
+                    stateAt(wp).store(SLOT_UNUSED, std::memory_order_relaxed);
+                }
 
-                write_ptr_.store(raw_.data() + required_size, std::memory_order_relaxed);
-                // spdlog::debug("(4) getting slot wp{}, fp{}", wp-raw_.data(),
-                // fp-raw_.data());
-                return setLengthAt(raw_.data(), data_size);
+                return commitSlot(0, required_size);
             }
         }
-        return nullptr;
+        return npos;
     }
 
-    constexpr auto setLengthAt(T* begin, std::uint16_t size) noexcept -> T*
+    auto addOverflow() -> ring_buffer&
     {
-        auto* len = reinterpret_cast<std::uint16_t*>(begin);
-        *len = size;
-        auto* flag = reinterpret_cast<std::uint16_t*>(begin + 2);
-        *flag = 0;
-
-        flush();
-        return begin;
+        auto& ring = *overflow_.emplace_back(std::make_unique<ring_buffer>());
+        ring.reserved_ = reserved_;
+        return ring;
     }
 
-    void flush() noexcept
+    // called with the producers locked out, once the ring itself is full
+    auto allocOverflow(std::size_t slot_size, priority prio) noexcept -> slot
     {
-        std::atomic_thread_fence(std::memory_order_release);
-        std::atomic_store_explicit(&flag_, true, std::memory_order_release);
+        for(auto& ring : overflow_) {
+            if(auto ret = ring->try_alloc(slot_size, prio)) {
+                return ret;
+            }
+        }
+        if(overflow_.size() < overflow_limit_) {
+            try {
+                return addOverflow().try_alloc(slot_size, prio);
+            } catch(const std::bad_alloc&) {
+                // out of memory, fail like a full ring
+            }
+        }
+        return {};
     }
-    void synchronize() const noexcept
+
+    /**
+     * Frees the drained overflow rings beyond the preallocated ones.
+     * Called with the producers locked out, no slot can be allocated from them
+     * in the meantime.
+     */
+    void retireOverflow() noexcept
     {
-        std::atomic_load_explicit(&flag_, std::memory_order_acquire);
-        std::atomic_thread_fence(std::memory_order_acquire);
+        for(auto i = overflow_.size(); i > overflow_kept_; --i) {
+            auto& ring = *overflow_[i - 1];
+            ring.updateFreePtr();
+            // the acquire in updateFreePtr() synchronizes with the last release
+            if(ring.write_ptr_.load(std::memory_order_relaxed)
+               == ring.free_ptr_.load(std::memory_order_relaxed)) {
+                overflow_.erase(overflow_.begin() + static_cast<std::ptrdiff_t>(i - 1));
+            }
+        }
     }
 
-private:
-    constexpr static std::size_t hardware_destructive_interference_size = 64ul;
+    // writes the slot's header before the write cursor moves past it, releasing
+    // threads that acquire the cursor see the header, see skipUnused()
+    auto commitSlot(offset_type begin, std::size_t required_size) noexcept -> offset_type
+    {
+        setLengthAt(begin, required_size - HEADER_LEN);
+        write_ptr_.store(static_cast<offset_type>(begin + required_size),
+                         std::memory_order_release);
+        return begin;
+    }
 
+    // the slot is handed out by the calling thread, no synchronization required
+    auto setLengthAt(offset_type begin, std::size_t size) noexcept -> offset_type
+    {
+        auto* len = reinterpret_cast<std::uint16_t*>(at(begin));
+        *len = static_cast<std::uint16_t>(size);
+        stateAt(begin).store(SLOT_IN_USE, std::memory_order_relaxed);
 
-    T* raw_ptr_;
-    std::span<T, SIZE + HEADER_LEN> raw_;
+        if constexpr(tracing::enabled) {
+            timeAt(begin, ALLOC_TIME) = tracing::now();
+            timeAt(begin, FLUSH_TIME) = 0;
+        }
 
-    alignas(hardware_destructive_interference_size) std::atomic_bool flag_;
+        return begin;
+    }
 
-    using cursor_type = std::atomic<T*>;
-    static_assert(cursor_type::is_always_lock_free);
+private:
+    constexpr static std::size_t hardware_destructive_interference_size = 64ul;
 
-    // ensure the two pointers are on different cache lines
-    alignas(hardware_destructive_interference_size) cursor_type write_ptr_ = nullptr;
-    alignas(hardware_destructive_interference_size) cursor_type free_ptr_ = nullptr;
 
-    // do we need padding?..
-    // std::array<std::byte, hardware_destructive_interference_size - sizeof(cursor_type)> padding_;
+    T* raw_ptr_;
+    release_hook release_hook_ = nullptr;
+    std::size_t reserved_ = 0; // footprint kept back for high priority allocations
+
+    // elastic mode, only accessed by producers while they hold alloc_mtx_
+    std::vector<std::unique_ptr<ring_buffer>> overflow_;
+    std::size_t overflow_limit_ = 0;
+    std::size_t overflow_kept_ = 0;
+
+    using cursor_type = std::conditional_t<Policy::concurrent,
+                                           std::atomic<offset_type>,
+                                           detail::plain_atomic<offset_type>>;
+    static_assert(not Policy::concurrent
+                  or std::atomic<offset_type>::is_always_lock_free);
+
+    // serializes producers, if there can be more than one
+    using mutex_type = std::conditional_t<Policy::multi_producer,
+                                          detail::spin_mutex,
+                                          detail::null_mutex>;
+    alignas(hardware_destructive_interference_size) mutex_type alloc_mtx_;
+    // set by reclaim() for the thread holding alloc_mtx_
+    using flag_type = std::conditional_t<Policy::multi_producer,
+                                         std::atomic<bool>,
+                                         detail::plain_atomic<bool>>;
+    flag_type reclaim_pending_ = false;
+
+    // ensure the two cursors are on different cache lines
+    alignas(hardware_destructive_interference_size) cursor_type write_ptr_ = 0;
+    alignas(hardware_destructive_interference_size) cursor_type free_ptr_ = 0;
 };
 } // namespace messagecache
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <new>
+
+#include <messagecache/ring_buffer.hpp>
+
+namespace messagecache {
+
+/**
+ * std::pmr::memory_resource that carves allocations from slots of a ring_buffer,
+ * e.g. for the std::pmr containers a decoded message is made of.
+ * Allocations are bumped from a chain of slots, deallocation is a no-op. All
+ * memory is handed back to the ring at once by release() or by the destructor,
+ * so tie the resource to the lifetime of the message.
+ * Allocations that do not fit into a slot, or that arrive while the ring is full,
+ * are served by the upstream resource and returned to it by release().
+ *
+ * Like std::pmr::monotonic_buffer_resource, a ring_resource is not thread-safe.
+ * It may be released by another thread if the ring's policy allows this.
+ */
+template<typename RingBuffer>
+class ring_resource : public std::pmr::memory_resource
+{
+public:
+    using ring_type = RingBuffer;
+    using T = typename ring_type::T;
+
+    /**
+     * @param ring       the ring to allocate slots from
+     * @param chunk_size the size of the slots that are requested from the ring, at
+     *                   most the ring's max_slot_size()
+     * @param upstream   serves allocations that cannot be carved from the ring
+     */
+    explicit ring_resource(
+        ring_type& ring,
+        std::size_t chunk_size = 1024,
+        std::pmr::memory_resource* upstream = std::pmr::get_default_resource()) noexcept
+        : ring_(ring),
+          chunk_size_(std::max(chunk_size, sizeof(chunk) * 2)),
+          upstream_(upstream)
+    {}
+
+    ring_resource(const ring_resource&) = delete;
+    auto operator=(const ring_resource&) -> ring_resource& = delete;
+
+    ~ring_resource() override { release(); }
+
+    // hands all memory back to the ring and the upstream resource
+    void release() noexcept
+    {
+        while(chunks_) {
+            auto* current = chunks_;
+            chunks_ = current->prev;
+
+            auto storage = std::move(current->storage);
+            current->~chunk();
+            // storage goes out of scope and releases the chunk's slot
+        }
+        while(blocks_) {
+            auto* current = blocks_;
+            blocks_ = current->prev;
+            upstream_->deallocate(current, current->bytes, current->alignment);
+        }
+
+        cur_ = nullptr;
+        space_ = 0;
+    }
+
+    auto upstream_resource() const noexcept -> std::pmr::memory_resource*
+    {
+        return upstream_;
+    }
+
+protected:
+    auto do_allocate(std::size_t bytes, std::size_t alignment) -> void* override
+    {
+        if(auto* ptr = bump(bytes, alignment)) {
+            return ptr;
+        }
+
+        // the current chunk is exhausted, chain another one
+        if(newChunk(bytes + alignment)) {
+            auto* ptr = bump(bytes, alignment);
+            assert(ptr);
+            return ptr;
+        }
+        return allocateUpstream(bytes, alignment);
+    }
+
+    // the memory is reclaimed by release()
+    void do_deallocate(void*, std::size_t, std::size_t) override {}
+
+    auto do_is_equal(const std::pmr::memory_resource& other) const noexcept
+        -> bool override
+    {
+        return this == std::addressof(other);
+    }
+
+private:
+    // lives at the front of every slot the resource took from the ring
+    struct chunk
+    {
+        typename ring_type::slot storage;
+        chunk* prev;
+    };
+
+    // lives at the front of every block from the upstream resource
+    struct upstream_block
+    {
+        upstream_block* prev;
+        std::size_t bytes;
+        std::size_t alignment;
+    };
+
+    auto bump(std::size_t bytes, std::size_t alignment) noexcept -> void*
+    {
+        void* ptr = cur_;
+        if(not ptr or not std::align(alignment, bytes, ptr, space_)) {
+            return nullptr;
+        }
+        cur_ = static_cast<T*>(ptr) + bytes;
+        space_ -= bytes;
+        return ptr;
+    }
+
+    auto newChunk(std::size_t min_space) noexcept -> bool
+    {
+        // depends on the ring's header and on its reserve(), which may change
+        auto const limit = ring_.max_slot_size();
+        auto const size = sizeof(chunk) + alignof(chunk) + min_space;
+        if(size > limit) {
+            return false;
+        }
+
+        auto region = ring_.try_alloc(std::min(std::max(size, chunk_size_), limit));
+        if(not region) {
+            return false;
+        }
+
+        // the slot's data is only aligned to the ring's header
+        void* ptr = region.begin();
+        auto space = static_cast<std::size_t>(region.end() - region.begin());
+        std::align(alignof(chunk), sizeof(chunk), ptr, space);
+
+        chunks_ = ::new(ptr) chunk{std::move(region), chunks_};
+        cur_ = static_cast<T*>(ptr) + sizeof(chunk);
+        space_ = space - sizeof(chunk);
+        return true;
+    }
+
+    auto allocateUpstream(std::size_t bytes, std::size_t alignment) -> void*
+    {
+        alignment = std::max(alignment, alignof(upstream_block));
+        auto const offset = (sizeof(upstream_block) + alignment - 1) & ~(alignment - 1);
+
+        auto* raw = upstream_->allocate(offset + bytes, alignment);
+        blocks_ = ::new(raw) upstream_block{blocks_, offset + bytes, alignment};
+        return static_cast<T*>(raw) + offset;
+    }
+
+    ring_type& ring_;
+    std::size_t const chunk_size_;
+    std::pmr::memory_resource* const upstream_;
+
+    chunk* chunks_ = nullptr;
+    upstream_block* blocks_ = nullptr;
+
+    T* cur_ = nullptr;
+    std::size_t space_ = 0;
+};
+} // namespace messagecache
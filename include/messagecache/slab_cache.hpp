@@ -0,0 +1,370 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <new>
+#include <span>
+#include <type_traits>
+
+#include <messagecache/concurrency.hpp>
+#include <messagecache/ring_buffer.hpp>
+
+namespace messagecache {
+
+/**
+ * Size-class front for tiny messages (heartbeats, acks, ...).
+ * Carves fixed-size slabs from a ring_buffer and splits them into equally sized
+ * chunks, which are handed out in O(1) without touching the ring's cursors.
+ * A slab goes back to the ring as a whole once all of its chunks are released.
+ *
+ * A slab_cache belongs to the thread that allocates from it, create one per
+ * allocating thread on top of a shared ring. Slots may be released from any thread,
+ * the ring's policy must allow the slabs to be released from these threads.
+ * Sizes above the largest size class are not served, allocate them from the
+ * ring directly.
+ */
+template<typename RingBuffer, std::size_t SLAB_SIZE = 4096>
+class slab_cache
+{
+public:
+    using ring_type = RingBuffer;
+    using T = typename ring_type::T;
+    using policy_type = typename ring_type::policy_type;
+
+    constexpr static std::array<std::size_t, 3> size_classes{16, 32, 64};
+    constexpr static std::size_t MAX_SIZE = size_classes.back();
+
+    static_assert(SLAB_SIZE >= 512, "a slab must hold a couple of chunks");
+    static_assert(SLAB_SIZE <= std::numeric_limits<std::uint16_t>::max(),
+                  "a slab must fit into a single slot of the ring");
+
+private:
+    // index type of the chunks within a slab, NIL terminates the free lists
+    using index_type = std::uint16_t;
+    constexpr static index_type NIL = std::numeric_limits<index_type>::max();
+
+    using counter_type = std::conditional_t<policy_type::concurrent,
+                                            std::atomic<std::uint32_t>,
+                                            detail::plain_atomic<std::uint32_t>>;
+
+    // publication state of a chunk, see slot::flush()
+    using state_type = std::uint8_t;
+    using state_ref = std::conditional_t<policy_type::concurrent,
+                                         std::atomic_ref<state_type>,
+                                         detail::plain_atomic_ref<state_type>>;
+    constexpr static state_type CHUNK_IN_USE = 0;
+    constexpr static state_type CHUNK_PUBLISHED = 1;
+
+    constexpr static std::size_t hardware_destructive_interference_size = 64ul;
+
+    /**
+     * Lives at the front of the slab's region in the ring.
+     * The owning slab_cache pops chunks from its private list, other threads push
+     * released chunks to the shared list, which the owner takes over as a whole.
+     */
+    struct slab
+    {
+        slab(typename ring_type::slot&& region,
+             state_type* states,
+             T* chunks,
+             std::size_t chunk_size,
+             std::size_t chunk_count) noexcept
+            : storage(std::move(region)),
+              states(states),
+              chunks(chunks),
+              chunk_size(static_cast<index_type>(chunk_size)),
+              chunk_count(static_cast<index_type>(chunk_count))
+        {}
+
+        // the next free chunk, only called by the owner
+        auto pop() noexcept -> T*
+        {
+            if(local_free == NIL and remote_free.load(std::memory_order_relaxed) != NIL) {
+                local_free = static_cast<index_type>(
+                    remote_free.exchange(NIL, std::memory_order_acquire));
+            }
+
+            index_type idx;
+            if(local_free != NIL) {
+                idx = local_free;
+                local_free = linkAt(idx);
+            } else if(carved < chunk_count) {
+                idx = carved++;
+            } else {
+                return nullptr;
+            }
+
+            live.fetch_add(1, std::memory_order_relaxed);
+            stateAt(idx).store(CHUNK_IN_USE, std::memory_order_relaxed);
+            return chunkAt(idx);
+        }
+
+        // returns a chunk, callable from any thread
+        static void push(slab* s, T* chunk) noexcept
+        {
+            auto const idx = s->indexOf(chunk);
+
+            auto head = s->remote_free.load(std::memory_order_relaxed);
+            do {
+                s->linkAt(idx) = static_cast<index_type>(head);
+            } while(not s->remote_free.compare_exchange_weak(
+                head, idx, std::memory_order_release, std::memory_order_relaxed));
+
+            unref(s);
+        }
+
+        // drops a reference, the last one hands the slab back to the ring
+        static void unref(slab* s) noexcept
+        {
+            if(s->live.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                auto region = std::move(s->storage);
+                s->~slab();
+                // region goes out of scope and releases the slab's memory
+            }
+        }
+
+        auto chunkAt(index_type idx) const noexcept -> T*
+        {
+            return chunks + idx * chunk_size;
+        }
+
+        auto indexOf(const T* chunk) const noexcept -> index_type
+        {
+            return static_cast<index_type>((chunk - chunks) / chunk_size);
+        }
+
+        auto linkAt(index_type idx) noexcept -> index_type&
+        {
+            return *reinterpret_cast<index_type*>(chunkAt(idx));
+        }
+
+        auto stateAt(index_type idx) const noexcept -> state_ref
+        {
+            return state_ref(states[idx]);
+        }
+
+        typename ring_type::slot storage;
+        // one per chunk, in front of the chunks
+        state_type* const states;
+        T* const chunks;
+        index_type const chunk_size;
+        index_type const chunk_count;
+
+        // owner only
+        index_type carved = 0;
+        index_type local_free = NIL;
+
+        // chunks handed out, plus one while the slab is owned by a slab_cache
+        counter_type live{1};
+        alignas(hardware_destructive_interference_size) counter_type remote_free{NIL};
+    };
+
+public:
+    /**
+     * A slot takes ownership over a chunk of a slab.
+     * While a caller holds its slot, the data will not be erased from the cache.
+     * As soon as the slot is destroyed, the chunk may be reused.
+     * Like the slots of the ring, modifications are published by flush() and
+     * acquired by synchronize(), through a state byte of the chunk.
+     */
+    class slot
+    {
+    private:
+        friend slab_cache;
+
+        constexpr slot(slab* owner, T* begin, std::size_t size) noexcept
+            : slab_(owner), begin_(begin), size_(static_cast<std::uint16_t>(size))
+        {}
+
+    public:
+        // default-constructed slot points to invalid memory region
+        constexpr slot() noexcept : slab_(nullptr), begin_(nullptr), size_(0) {}
+
+        // delete copy
+        constexpr slot(const slot&) = delete;
+        constexpr auto operator=(const slot&) -> slot& = delete;
+
+        // move-only semantics
+        constexpr auto operator=(slot&& other) noexcept -> slot&
+        {
+            if(this != std::addressof(other)) {
+                release();
+
+                slab_ = other.slab_;
+                begin_ = other.begin_;
+                size_ = other.size_;
+
+                other.slab_ = nullptr;
+                other.begin_ = nullptr;
+                other.size_ = 0;
+            }
+            return *this;
+        }
+        constexpr slot(slot&& other) noexcept
+            : slab_(other.slab_), begin_(other.begin_), size_(other.size_)
+        {
+            other.slab_ = nullptr;
+            other.begin_ = nullptr;
+            other.size_ = 0;
+        }
+
+        // releases the slot's data
+        constexpr ~slot() noexcept { release(); }
+
+        // returns true if the slot points to a valid range of memory
+        constexpr auto valid() const noexcept -> bool { return slab_ != nullptr; }
+
+        constexpr operator bool() const noexcept { return valid(); }
+
+        // Releases the slot's data.
+        // Invalidates all iterators
+        void release() noexcept
+        {
+            if(slab_) {
+                slab::push(slab_, begin_);
+
+                slab_ = nullptr;
+                begin_ = nullptr;
+                size_ = 0;
+            }
+        }
+
+        constexpr auto begin() const noexcept -> T* { return begin_; }
+
+        constexpr auto cbegin() const noexcept -> const T* { return begin(); }
+
+        constexpr auto end() const noexcept -> T* { return begin() + size_; }
+
+        constexpr auto cend() const noexcept -> const T* { return cbegin() + size_; }
+
+        // Returns a read-only std::span over the chunk, synchronizes first
+        constexpr auto asSpan() const -> std::span<const std::byte>
+        {
+            synchronize();
+            return asSpan(same_thread);
+        }
+
+        // Returns a read-only std::span over the chunk, the caller filled it itself
+        constexpr auto asSpan(same_thread_t) const noexcept -> std::span<const std::byte>
+        {
+            return {cbegin(), size_};
+        }
+
+        // Returns a mutable std::span over the chunk, synchronizes first
+        constexpr auto asMutableSpan() -> std::span<std::byte>
+        {
+            synchronize();
+            return asMutableSpan(same_thread);
+        }
+
+        // Returns a mutable std::span over the chunk, the caller filled it itself
+        constexpr auto asMutableSpan(same_thread_t) noexcept -> std::span<std::byte>
+        {
+            return {begin(), size_};
+        }
+
+        // Publishes the modifications of the chunk to threads calling synchronize()
+        void flush() noexcept
+        {
+            if(slab_) {
+                slab_->stateAt(slab_->indexOf(begin_))
+                    .store(CHUNK_PUBLISHED, std::memory_order_release);
+            }
+        }
+
+        // Acquires the modifications published by flush() on another thread,
+        // returns false if the chunk was not flushed yet
+        auto synchronize() const noexcept -> bool
+        {
+            return slab_
+                   and slab_->stateAt(slab_->indexOf(begin_))
+                               .load(std::memory_order_acquire)
+                           == CHUNK_PUBLISHED;
+        }
+
+    private:
+        slab* slab_;
+        T* begin_;
+        std::uint16_t size_;
+    };
+
+    explicit slab_cache(ring_type& ring) noexcept : ring_(ring) {}
+
+    // the current slabs return to the ring as soon as their chunks are released
+    ~slab_cache() noexcept
+    {
+        for(auto* current : current_) {
+            if(current) {
+                slab::unref(current);
+            }
+        }
+    }
+
+    slab_cache(const slab_cache&) = delete;
+    auto operator=(const slab_cache&) -> slab_cache& = delete;
+
+    // try to allocate a slot of the given size, at most MAX_SIZE bytes
+    auto try_alloc(std::size_t slot_size) noexcept -> slot
+    {
+        if(slot_size == 0 or slot_size > MAX_SIZE) {
+            return {};
+        }
+
+        std::size_t cls = 0;
+        while(size_classes[cls] < slot_size) {
+            ++cls;
+        }
+
+        auto*& current = current_[cls];
+        if(current) {
+            if(auto* chunk = current->pop()) {
+                return slot{current, chunk, slot_size};
+            }
+            // the slab is exhausted, it returns to the ring once its chunks are released
+            slab::unref(current);
+        }
+
+        current = newSlab(size_classes[cls]);
+        if(not current) {
+            return {}; // the ring is full
+        }
+        return slot{current, current->pop(), slot_size};
+    }
+
+private:
+    auto newSlab(std::size_t chunk_size) noexcept -> slab*
+    {
+        auto region = ring_.try_alloc(SLAB_SIZE);
+        if(not region) {
+            return nullptr;
+        }
+
+        void* ptr = region.begin();
+        std::size_t space = SLAB_SIZE;
+        std::align(alignof(slab), sizeof(slab), ptr, space);
+        auto* s = static_cast<slab*>(ptr);
+
+        // the states of the chunks follow the slab header, each takes a byte
+        auto* states = reinterpret_cast<state_type*>(static_cast<T*>(ptr) + sizeof(slab));
+        space -= sizeof(slab);
+        auto const count = std::min<std::size_t>(
+            (space - alignof(std::max_align_t)) / (chunk_size + sizeof(state_type)), NIL);
+
+        // chunks start at the next max_align_t boundary behind the states
+        void* chunks = states + count;
+        space -= count * sizeof(state_type);
+        std::align(alignof(std::max_align_t), chunk_size, chunks, space);
+
+        return ::new(s) slab(
+            std::move(region), states, static_cast<T*>(chunks), chunk_size, count);
+    }
+
+    ring_type& ring_;
+    std::array<slab*, size_classes.size()> current_{};
+};
+} // namespace messagecache
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+namespace messagecache {
+
+/**
+ * Opt-in latency tracing of the messages in a ring_buffer.
+ * Define MESSAGECACHE_ENABLE_TRACING to record when a slot is allocated, flushed,
+ * synchronized and released, each latency once per slot. The timestamps are kept
+ * in the slot header, the latencies are collected into log2 histograms per thread.
+ * Without the macro, the slot header and all accessors stay as they are and
+ * nothing is recorded.
+ */
+namespace tracing {
+
+#if defined(MESSAGECACHE_ENABLE_TRACING)
+inline constexpr bool enabled = true;
+#else
+inline constexpr bool enabled = false;
+#endif
+
+// the latencies that are recorded
+enum class event : std::uint8_t
+{
+    fill,      // try_alloc() to the producer's first flush()
+    handoff,   // the first flush() to the first synchronize() that observes it
+    residency, // try_alloc() to the slot's release()
+};
+constexpr static std::size_t EVENTS = 3;
+
+// bucket i counts latencies of less than 2^(i+1) nanoseconds, and at least 2^i
+constexpr static std::size_t BUCKETS = 64;
+
+// nanoseconds on the steady clock
+inline auto now() noexcept -> std::uint64_t
+{
+    return static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch())
+            .count());
+}
+
+// histogram of the latencies of one event
+struct distribution
+{
+    std::array<std::uint64_t, BUCKETS> buckets{};
+
+    auto count() const noexcept -> std::uint64_t
+    {
+        std::uint64_t sum = 0;
+        for(auto n : buckets) {
+            sum += n;
+        }
+        return sum;
+    }
+
+    // upper bound of the bucket that holds the given percentile, p in [0, 1]
+    auto percentile(double p) const noexcept -> std::chrono::nanoseconds
+    {
+        auto const total = count();
+        if(total == 0) {
+            return {};
+        }
+
+        auto const rank = static_cast<std::uint64_t>(p * static_cast<double>(total - 1));
+        std::uint64_t seen = 0;
+        for(std::size_t i = 0; i < BUCKETS; ++i) {
+            seen += buckets[i];
+            if(seen > rank) {
+                return std::chrono::nanoseconds{(std::uint64_t{2} << i) - 1};
+            }
+        }
+        return std::chrono::nanoseconds::max();
+    }
+};
+
+// the distributions of all threads, see snapshot()
+struct report
+{
+    distribution fill;
+    distribution handoff;
+    distribution residency;
+};
+
+namespace detail {
+
+// written by its thread only, read by snapshot()
+struct thread_log
+{
+    std::array<std::array<std::atomic<std::uint64_t>, BUCKETS>, EVENTS> counts{};
+};
+
+class registry
+{
+public:
+    static auto instance() -> registry&
+    {
+        static registry r;
+        return r;
+    }
+
+    // the log of the calling thread, registered on first use
+    auto local() -> thread_log&
+    {
+        thread_local thread_log* log = nullptr;
+        if(not log) {
+            std::lock_guard lock(mtx_);
+            log = &logs_.emplace_back();
+        }
+        return *log;
+    }
+
+    template<typename F>
+    void forEach(F&& f)
+    {
+        std::lock_guard lock(mtx_);
+        for(auto& log : logs_) {
+            f(log);
+        }
+    }
+
+private:
+    std::mutex mtx_;
+    // logs of exited threads are kept, their latencies still count
+    std::deque<thread_log> logs_;
+};
+
+} // namespace detail
+
+// adds a latency to the calling thread's histogram, does not synchronize
+inline void record(event e, std::uint64_t begin, std::uint64_t end) noexcept
+{
+    auto const ns = end > begin ? end - begin : 0;
+    auto const bucket = ns ? static_cast<std::size_t>(std::bit_width(ns)) - 1 : 0;
+
+    auto& counter =
+        detail::registry::instance().local().counts[static_cast<std::size_t>(e)][bucket];
+    counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+// sums up the histograms of all threads
+inline auto snapshot() -> report
+{
+    report r;
+    detail::registry::instance().forEach([&](detail::thread_log& log) {
+        distribution* dists[EVENTS] = {&r.fill, &r.handoff, &r.residency};
+        for(std::size_t e = 0; e < EVENTS; ++e) {
+            for(std::size_t i = 0; i < BUCKETS; ++i) {
+                dists[e]->buckets[i] += log.counts[e][i].load(std::memory_order_relaxed);
+            }
+        }
+    });
+    return r;
+}
+
+// clears all histograms, call while no messages are traced
+inline void reset()
+{
+    detail::registry::instance().forEach([](detail::thread_log& log) {
+        for(auto& counts : log.counts) {
+            for(auto& counter : counts) {
+                counter.store(0, std::memory_order_relaxed);
+            }
+        }
+    });
+}
+
+} // namespace tracing
+} // namespace messagecache
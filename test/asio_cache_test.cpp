@@ -0,0 +1,209 @@
+#include <gtest/gtest.h>
+#include <messagecache/asio_cache.hpp>
+
+#include <string>
+#include <vector>
+
+TEST(asio_cache_test, watermarks_signal_once_per_crossing) {
+    messagecache::asio_cache<200> cache;
+
+    int high = 0;
+    int low = 0;
+    cache.set_watermarks(40, 120, [&] { ++high; }, [&] { ++low; });
+
+    std::vector<decltype(cache)::slot> slots;
+    while(auto slot = cache.try_alloc(16)) {
+        slots.push_back(std::move(slot));
+    }
+
+    ASSERT_EQ(high, 1);
+    ASSERT_EQ(low, 0);
+    ASSERT_TRUE(cache.above_high_watermark());
+
+    // drain in order until the occupancy falls to the low watermark
+    while(cache.occupancy() > 40) {
+        slots.erase(slots.begin());
+    }
+
+    ASSERT_EQ(high, 1);
+    ASSERT_EQ(low, 1);
+    ASSERT_FALSE(cache.above_high_watermark());
+
+    slots.clear();
+    ASSERT_EQ(low, 1);
+}
+
+TEST(asio_cache_test, low_watermark_after_out_of_order_release) {
+    messagecache::asio_cache<200> cache;
+
+    int low = 0;
+    cache.set_watermarks(40, 120, [] {}, [&] { ++low; });
+
+    std::vector<decltype(cache)::slot> slots;
+    while(auto slot = cache.try_alloc(16)) {
+        slots.push_back(std::move(slot));
+    }
+    ASSERT_TRUE(cache.above_high_watermark());
+
+    // release everything but the first slot, the free cursor is stuck behind it
+    while(slots.size() > 1) {
+        slots.pop_back();
+    }
+    ASSERT_EQ(low, 0);
+
+    slots.clear();
+    ASSERT_EQ(low, 1);
+    ASSERT_EQ(cache.occupancy(), 0u);
+}
+
+template<typename Policy>
+class asio_cache_policy_test : public ::testing::Test
+{};
+
+using policies = ::testing::Types<messagecache::concurrency::single_thread,
+                                  messagecache::concurrency::spsc,
+                                  messagecache::concurrency::mpsc,
+                                  messagecache::concurrency::mpmc>;
+TYPED_TEST_SUITE(asio_cache_policy_test, policies);
+
+TYPED_TEST(asio_cache_policy_test, low_watermark_after_out_of_order_release) {
+    // leaves a tail behind the last slot that fits
+    messagecache::asio_cache<210, TypeParam> cache;
+
+    int high = 0;
+    int low = 0;
+    cache.set_watermarks(40, 120, [&] { ++high; }, [&] { ++low; });
+
+    std::vector<typename decltype(cache)::slot> slots;
+    while(auto slot = cache.try_alloc(16)) {
+        slots.push_back(std::move(slot));
+    }
+    ASSERT_EQ(high, 1);
+
+    // the first slot keeps the free cursor in front of all others
+    while(slots.size() > 1) {
+        slots.pop_back();
+    }
+    ASSERT_EQ(low, 0);
+
+    slots.clear();
+    ASSERT_EQ(low, 1);
+    ASSERT_EQ(cache.occupancy(), 0u);
+    ASSERT_FALSE(cache.above_high_watermark());
+
+    // again with slots that wrapped around the end of the ring
+    for(int i = 0; i < 5; ++i) {
+        slots.push_back(cache.try_alloc(16));
+    }
+    slots.erase(slots.begin(), slots.begin() + 3);
+    while(auto slot = cache.try_alloc(16)) {
+        slots.push_back(std::move(slot));
+    }
+    ASSERT_EQ(high, 2);
+
+    while(slots.size() > 1) {
+        slots.pop_back();
+    }
+    ASSERT_EQ(low, 1);
+
+    slots.clear();
+    ASSERT_EQ(low, 2);
+    ASSERT_EQ(cache.occupancy(), 0u);
+    ASSERT_FALSE(cache.above_high_watermark());
+}
+
+TEST(asio_cache_test, alloc_completes_without_waiting) {
+    asio::io_context ctx;
+    messagecache::asio_cache<200> cache;
+
+    bool done = false;
+    cache.alloc(16, asio::bind_executor(ctx, [&](asio::error_code e, auto slot) {
+                    ASSERT_FALSE(e);
+                    ASSERT_TRUE(slot.valid());
+                    done = true;
+                }));
+
+    // the handler does not run inside alloc()
+    ASSERT_FALSE(done);
+    ctx.run();
+    ASSERT_TRUE(done);
+}
+
+TEST(asio_cache_test, alloc_fails_sizes_that_never_fit) {
+    asio::io_context ctx;
+    messagecache::asio_cache<1 << 20> large;
+    messagecache::asio_cache<200> small;
+
+    int failed = 0;
+    auto handler = asio::bind_executor(ctx, [&](asio::error_code e, auto slot) {
+        ASSERT_EQ(e, asio::error::message_size);
+        ASSERT_FALSE(slot.valid());
+        ++failed;
+    });
+
+    // larger than a slot header can describe, and larger than the ring
+    large.alloc(70000, handler);
+    small.alloc(201, handler);
+
+    // the reserved capacity is out of reach for normal allocations
+    small.reserve(50);
+    small.alloc(small.max_slot_size() + 1, handler);
+
+    ctx.run();
+    ASSERT_EQ(failed, 3);
+}
+
+TEST(asio_cache_test, read_into_cache_limits_to_max_slot_size) {
+    asio::io_context ctx;
+    asio::local::stream_protocol::socket rx(ctx);
+    asio::local::stream_protocol::socket tx(ctx);
+    asio::local::connect_pair(rx, tx);
+
+    messagecache::asio_cache<1 << 20> cache;
+    std::string const message(70000, 'x');
+    asio::write(tx, asio::buffer(message));
+
+    std::size_t received = 0;
+    cache.async_read_into_cache(rx, 65536, [&](asio::error_code e, auto slot) {
+        ASSERT_FALSE(e);
+        received = slot.getConstBuffer(messagecache::same_thread).size();
+    });
+    ctx.run();
+
+    ASSERT_GT(received, 0u);
+    ASSERT_LE(received, cache.max_slot_size());
+}
+
+TEST(asio_cache_test, read_into_cache_shrinks_slot) {
+    asio::io_context ctx;
+    asio::local::stream_protocol::socket rx(ctx);
+    asio::local::stream_protocol::socket tx(ctx);
+    asio::local::connect_pair(rx, tx);
+
+    messagecache::asio_cache<2000> cache;
+    std::string const message = "hello from the other side";
+    asio::write(tx, asio::buffer(message));
+
+    decltype(cache)::slot received;
+    cache.async_read_into_cache(rx, 1024, [&](asio::error_code e, auto slot) {
+        ASSERT_FALSE(e);
+        received = std::move(slot);
+    });
+    ctx.run();
+
+    ASSERT_TRUE(received.valid());
+    auto buffer = received.getConstBuffer(messagecache::same_thread);
+    ASSERT_EQ(buffer.size(), message.size());
+    auto const* data = static_cast<const char*>(buffer.data());
+    ASSERT_EQ(std::string(data, buffer.size()), message);
+
+    // the peer closed, the operation completes with an empty slot
+    received.release();
+    tx.close();
+    ctx.restart();
+    cache.async_read_into_cache(rx, 1024, [&](asio::error_code e, auto slot) {
+        ASSERT_EQ(e, asio::error::eof);
+        ASSERT_FALSE(slot.valid());
+    });
+    ctx.run();
+}
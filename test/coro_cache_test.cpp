@@ -0,0 +1,186 @@
+#include <gtest/gtest.h>
+#include <messagecache/coro_cache.hpp>
+
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <vector>
+
+// slot sizes in the ring, the header grows with MESSAGECACHE_ENABLE_TRACING
+constexpr auto footprint(std::size_t data_size) -> std::size_t
+{
+    return messagecache::ring_buffer<64>::footprint(data_size);
+}
+
+// eagerly started coroutine without a result
+struct task
+{
+    struct promise_type
+    {
+        auto get_return_object() noexcept -> task { return {}; }
+        auto initial_suspend() noexcept -> std::suspend_never { return {}; }
+        auto final_suspend() noexcept -> std::suspend_never { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+// keeps the slot it received and logs its id once it got it
+template<typename Cache>
+auto receive(Cache& cache,
+             std::size_t size,
+             std::deque<typename Cache::slot>& held,
+             std::vector<int>& received,
+             int id,
+             messagecache::priority prio = messagecache::priority::normal) -> task
+{
+    held.push_back(co_await cache.alloc(size, prio));
+    received.push_back(id);
+}
+
+// releases the oldest held slot, the awaiters it wakes may hold slots in turn
+template<typename Slot>
+void releaseFront(std::deque<Slot>& held)
+{
+    auto slot = std::move(held.front());
+    held.pop_front();
+}
+
+template<typename Policy>
+class coro_cache_policy_test : public ::testing::Test
+{};
+
+using policies = ::testing::Types<messagecache::concurrency::single_thread,
+                                  messagecache::concurrency::spsc,
+                                  messagecache::concurrency::mpsc,
+                                  messagecache::concurrency::mpmc>;
+TYPED_TEST_SUITE(coro_cache_policy_test, policies);
+
+TYPED_TEST(coro_cache_policy_test, suspends_when_full) {
+    using cache_type = messagecache::coro_cache<2 * footprint(100), TypeParam>;
+    cache_type cache;
+    std::deque<typename cache_type::slot> held;
+    std::vector<int> received;
+
+    // completes without suspending while there is space
+    receive(cache, 100, held, received, 0);
+    receive(cache, 100, held, received, 1);
+    ASSERT_EQ(received, (std::vector<int>{0, 1}));
+
+    receive(cache, 100, held, received, 2);
+    ASSERT_EQ(received.size(), 2u);
+    ASSERT_EQ(held.size(), 2u);
+
+    while(not held.empty()) {
+        releaseFront(held);
+    }
+    ASSERT_EQ(received, (std::vector<int>{0, 1, 2}));
+}
+
+TYPED_TEST(coro_cache_policy_test, resumes_in_order_on_release) {
+    using cache_type = messagecache::coro_cache<2 * footprint(100), TypeParam>;
+    cache_type cache;
+    std::deque<typename cache_type::slot> held;
+    std::vector<int> received;
+
+    receive(cache, 100, held, received, 0);
+    receive(cache, 100, held, received, 1);
+    receive(cache, 50, held, received, 2);
+    receive(cache, 50, held, received, 3);
+    ASSERT_EQ(received, (std::vector<int>{0, 1}));
+
+    // each release makes room for one smaller slot, the first awaiter in line gets it
+    releaseFront(held);
+    ASSERT_EQ(received, (std::vector<int>{0, 1, 2}));
+    releaseFront(held);
+    ASSERT_EQ(received, (std::vector<int>{0, 1, 2, 3}));
+
+    while(not held.empty()) {
+        releaseFront(held);
+    }
+}
+
+TYPED_TEST(coro_cache_policy_test, move_assign_releases_the_previous_slot) {
+    using cache_type = messagecache::coro_cache<2 * footprint(100), TypeParam>;
+    cache_type cache;
+    std::deque<typename cache_type::slot> held;
+    std::vector<int> received;
+
+    receive(cache, 100, held, received, 0);
+    receive(cache, 100, held, received, 1);
+    receive(cache, 50, held, received, 2);
+    ASSERT_EQ(received.size(), 2u);
+
+    // overwriting a slot releases it and wakes the awaiter
+    auto slot = std::move(held.front());
+    held.pop_front();
+    auto other = std::move(held.front());
+    held.pop_front();
+    slot = std::move(other);
+    ASSERT_TRUE(slot.valid());
+    ASSERT_FALSE(other.valid());
+    ASSERT_EQ(received, (std::vector<int>{0, 1, 2}));
+
+    // so does assigning an empty slot
+    receive(cache, 50, held, received, 3);
+    ASSERT_EQ(received.size(), 3u);
+    slot = typename cache_type::slot{};
+    ASSERT_FALSE(slot.valid());
+    ASSERT_EQ(received, (std::vector<int>{0, 1, 2, 3}));
+
+    while(not held.empty()) {
+        releaseFront(held);
+    }
+}
+
+TYPED_TEST(coro_cache_policy_test, high_priority_awaiters_wake_first) {
+    using cache_type = messagecache::coro_cache<3 * footprint(100), TypeParam>;
+    cache_type cache;
+    cache.reserve(100);
+    std::deque<typename cache_type::slot> held;
+    std::vector<int> received;
+    auto const high = messagecache::priority::high;
+
+    // bulk traffic fills the ring up to the reserve, a high priority slot takes it
+    receive(cache, 100, held, received, 0);
+    receive(cache, 100, held, received, 1);
+    receive(cache, 100, held, received, 2, high);
+    ASSERT_EQ(received, (std::vector<int>{0, 1, 2}));
+
+    // the high priority awaiter queues up in front of the normal ones
+    receive(cache, 50, held, received, 3);
+    receive(cache, 50, held, received, 4);
+    receive(cache, 50, held, received, 5, high);
+    ASSERT_EQ(received.size(), 3u);
+
+    // the released slot only fits into the reserve, normal awaiters may not take it
+    releaseFront(held);
+    ASSERT_EQ(received, (std::vector<int>{0, 1, 2, 5}));
+
+    while(not held.empty()) {
+        releaseFront(held);
+    }
+    ASSERT_EQ(received, (std::vector<int>{0, 1, 2, 5, 3, 4}));
+}
+
+TYPED_TEST(coro_cache_policy_test, high_priority_passes_normal_awaiters) {
+    using cache_type = messagecache::coro_cache<3 * footprint(100), TypeParam>;
+    cache_type cache;
+    cache.reserve(100);
+    std::deque<typename cache_type::slot> held;
+    std::vector<int> received;
+
+    receive(cache, 100, held, received, 0);
+    receive(cache, 100, held, received, 1);
+    receive(cache, 50, held, received, 2);
+    ASSERT_EQ(received.size(), 2u);
+
+    // no high priority awaiter in front, allocates from the reserve without suspending
+    receive(cache, 100, held, received, 3, messagecache::priority::high);
+    ASSERT_EQ(received, (std::vector<int>{0, 1, 3}));
+
+    while(not held.empty()) {
+        releaseFront(held);
+    }
+    ASSERT_EQ(received, (std::vector<int>{0, 1, 3, 2}));
+}
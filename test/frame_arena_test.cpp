@@ -0,0 +1,115 @@
+
+#include <gtest/gtest.h>
+#include <messagecache/coro_cache.hpp>
+#include <messagecache/frame_arena.hpp>
+
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <vector>
+
+using arena_type =
+    messagecache::frame_arena<16384, messagecache::concurrency::single_thread>;
+
+// eagerly started coroutine without a result
+struct task
+{
+    struct promise_type : messagecache::arena_frame<arena_type>
+    {
+        auto get_return_object() noexcept -> task { return {}; }
+        auto initial_suspend() noexcept -> std::suspend_never { return {}; }
+        auto final_suspend() noexcept -> std::suspend_never { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+// GCC pairs the frame's template operator new with a template operator delete, which
+// cannot exist. Its -Wmismatched-new-delete is a false positive for arena frames.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+auto suspended(std::allocator_arg_t, arena_type&, std::coroutine_handle<>& handle) -> task
+{
+    struct capture
+    {
+        std::coroutine_handle<>& handle;
+        auto await_ready() noexcept -> bool { return false; }
+        void await_suspend(std::coroutine_handle<> h) noexcept { handle = h; }
+        void await_resume() noexcept {}
+    };
+    co_await capture{handle};
+}
+#pragma GCC diagnostic pop
+
+auto on_heap(int& value) -> task
+{
+    ++value;
+    co_return;
+}
+
+TEST(frame_arena_test, frames_live_in_the_arena) {
+    arena_type arena;
+
+    std::coroutine_handle<> handle;
+    suspended(std::allocator_arg, arena, handle);
+    ASSERT_TRUE(handle);
+    ASSERT_GT(arena.occupancy(), 0u);
+
+    // the frame is released once the coroutine completes
+    handle.resume();
+    ASSERT_EQ(arena.occupancy(), 0u);
+}
+
+TEST(frame_arena_test, frames_without_arena_use_the_heap) {
+    int value = 0;
+    on_heap(value);
+    ASSERT_EQ(value, 1);
+}
+
+TEST(frame_arena_test, falls_back_to_heap_when_full) {
+    arena_type arena;
+
+    std::vector<void*> blocks;
+    for(int i = 0; i < 8; ++i) {
+        blocks.push_back(arena.allocate(4000));
+        ASSERT_EQ(reinterpret_cast<std::uintptr_t>(blocks.back()) % arena_type::ALIGNMENT,
+                  0u);
+    }
+    for(auto* block : blocks) {
+        arena_type::deallocate(block);
+    }
+    ASSERT_EQ(arena.occupancy(), 0u);
+}
+
+TEST(frame_arena_test, allocator_for_containers) {
+    arena_type arena;
+    {
+        std::vector<int, arena_type::allocator<int>> values{arena.get_allocator()};
+        for(int i = 0; i < 100; ++i) {
+            values.push_back(i);
+        }
+        ASSERT_EQ(values[99], 99);
+        ASSERT_GT(arena.occupancy(), 0u);
+    }
+    arena.reclaim();
+    ASSERT_EQ(arena.occupancy(), 0u);
+}
+
+TEST(frame_arena_test, awaiting_the_cache_from_an_arena_frame) {
+    arena_type arena;
+    messagecache::coro_cache<1000, messagecache::concurrency::single_thread> cache;
+
+    std::size_t received = 0;
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete" // see suspended()
+    auto receive = [&](std::allocator_arg_t, arena_type&) -> task {
+        auto slot = co_await cache.alloc(100);
+        received += slot.asSpan(messagecache::same_thread).size();
+    };
+#pragma GCC diagnostic pop
+    for(int i = 0; i < 20; ++i) {
+        receive(std::allocator_arg, arena);
+    }
+    ASSERT_EQ(received, 2000u);
+    ASSERT_EQ(arena.occupancy(), 0u);
+}
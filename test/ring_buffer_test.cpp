@@ -2,6 +2,18 @@
 #include <gtest/gtest.h>
 #include <messagecache/ring_buffer.hpp>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <deque>
+#include <thread>
+
+// slot sizes in the ring, the header grows with MESSAGECACHE_ENABLE_TRACING
+constexpr auto footprint(std::size_t data_size) -> std::size_t
+{
+    return messagecache::ring_buffer<64>::footprint(data_size);
+}
+
 TEST(ring_buffer_test, front_alloc) {
     messagecache::ring_buffer<20> buffer;
 
@@ -12,7 +24,7 @@ TEST(ring_buffer_test, front_alloc) {
 }
 
 TEST(ring_buffer_test, two_allocs_full) {
-    messagecache::ring_buffer<20> buffer;
+    messagecache::ring_buffer<footprint(10) + footprint(6) - footprint(0)> buffer;
 
     auto slot = buffer.try_alloc(10);
 
@@ -128,4 +140,297 @@ TEST(ring_buffer_test, many_allocs_and_frees) {
     // allocate another front to propagate the fp through the right-side boundary
     auto slot = buffer.try_alloc(100);
     slots.push_back(std::move(slot));
-}
\ No newline at end of file
+}
+TEST(ring_buffer_test, compact_slot_handle) {
+    using buffer_type = messagecache::ring_buffer<2000>;
+
+    static_assert(sizeof(buffer_type::offset_type) == 4);
+    static_assert(sizeof(buffer_type::slot) <= 16);
+}
+
+TEST(ring_buffer_test, move_ring_keeps_cursors) {
+    messagecache::ring_buffer<footprint(20) + footprint(15) - footprint(0)> buffer;
+
+    {
+        auto slot = buffer.try_alloc(10);
+        auto slot2 = buffer.try_alloc(10);
+        ASSERT_TRUE(slot.valid());
+        ASSERT_TRUE(slot2.valid());
+
+        // release out of order, the second slot is only marked as unused
+        slot2.release();
+    }
+
+    // the cursors are offsets and carry over to the new owner of the storage
+    auto moved = std::move(buffer);
+
+    auto slot = moved.try_alloc(20);
+    ASSERT_TRUE(slot.valid());
+    ASSERT_EQ(slot.end() - slot.begin(), 20);
+
+    auto slot2 = moved.try_alloc(15);
+    ASSERT_TRUE(slot2.valid());
+    ASSERT_EQ(slot2.begin() - slot.end(), footprint(20) - 20);
+}
+
+TEST(ring_buffer_test, odd_sizes_keep_headers_aligned) {
+    messagecache::ring_buffer<64> buffer;
+
+    auto slot = buffer.try_alloc(7);
+    auto slot2 = buffer.try_alloc(3);
+
+    ASSERT_TRUE(slot.valid());
+    ASSERT_TRUE(slot2.valid());
+    ASSERT_EQ(slot.end() - slot.begin(), 7);
+    ASSERT_EQ(reinterpret_cast<std::uintptr_t>(slot2.begin()) % 2, 0u);
+}
+
+TEST(ring_buffer_test, same_thread_access) {
+    messagecache::ring_buffer<20> buffer;
+
+    auto slot = buffer.try_alloc(10);
+    memset(slot.begin(), 'a', 10);
+
+    auto span = slot.asSpan(messagecache::same_thread);
+    ASSERT_EQ(span.size(), 10u);
+    ASSERT_EQ(static_cast<char>(span[9]), 'a');
+}
+
+// Hands slots to a second thread, which releases them partly out of order.
+// The producer keeps reusing the regions that the consumer handed back.
+TEST(ring_buffer_test, concurrent_handoff_stress) {
+    messagecache::ring_buffer<4096> buffer;
+    using slot_type = decltype(buffer)::slot;
+
+    constexpr int messages = 100000;
+    constexpr int cells = 64;
+
+    // the index only orders the handles, a slot is handed over before it is filled
+    // and its data is ordered by flush() and synchronize() alone
+    std::array<slot_type, cells> handoff;
+    std::atomic<int> allocated = 0;
+    std::atomic<int> taken = 0;
+
+    auto producer = std::jthread([&] {
+        for(int i = 0; i < messages; ++i) {
+            auto const size = static_cast<std::size_t>(1 + i % 61);
+            auto slot = buffer.try_alloc(size);
+            while(not slot) {
+                std::this_thread::yield();
+                slot = buffer.try_alloc(size);
+            }
+            while(i - taken.load(std::memory_order_acquire) == cells) {
+                std::this_thread::yield();
+            }
+            auto& cell = handoff[i % cells];
+            cell = std::move(slot);
+            allocated.store(i + 1, std::memory_order_release);
+
+            // the consumer leaves the handle in place until it sees the flush
+            memset(cell.begin(), i & 0xff, size);
+            cell.flush();
+        }
+    });
+
+    slot_type held;
+    for(int i = 0; i < messages; ++i) {
+        while(allocated.load(std::memory_order_acquire) == i) {
+            std::this_thread::yield();
+        }
+        auto& cell = handoff[i % cells];
+        while(not cell.synchronize()) {
+            std::this_thread::yield();
+        }
+        auto slot = std::move(cell);
+        taken.store(i + 1, std::memory_order_release);
+
+        auto span = slot.asSpan();
+        ASSERT_EQ(span.size(), static_cast<std::size_t>(1 + i % 61));
+        for(auto v : span) {
+            ASSERT_EQ(static_cast<int>(v), i & 0xff);
+        }
+
+        if(i % 3 == 0) {
+            // keep this one alive while the next slot is released
+            held = std::move(slot);
+        }
+    }
+}
+
+template<typename Policy>
+class ring_buffer_policy_test : public ::testing::Test
+{};
+
+using policies = ::testing::Types<messagecache::concurrency::single_thread,
+                                  messagecache::concurrency::spsc,
+                                  messagecache::concurrency::mpsc,
+                                  messagecache::concurrency::mpmc>;
+TYPED_TEST_SUITE(ring_buffer_policy_test, policies);
+
+TYPED_TEST(ring_buffer_policy_test, release_out_of_order_and_wrap) {
+    messagecache::ring_buffer<3 * footprint(30), TypeParam> buffer;
+
+    auto a = buffer.try_alloc(30);
+    auto b = buffer.try_alloc(30);
+    auto c = buffer.try_alloc(30);
+    ASSERT_TRUE(a.valid());
+    ASSERT_TRUE(b.valid());
+    ASSERT_TRUE(c.valid());
+    ASSERT_FALSE(buffer.try_alloc(30).valid());
+
+    // b is only marked as unused, a advances the free cursor
+    b.release();
+    a.release();
+
+    // wraps around to the front
+    auto d = buffer.try_alloc(60);
+    ASSERT_TRUE(d.valid());
+    ASSERT_LT(d.begin(), c.begin());
+}
+
+TEST(ring_buffer_test, reserved_capacity_for_high_priority) {
+    messagecache::ring_buffer<2000> buffer;
+    buffer.reserve(100);
+
+    std::vector<decltype(buffer)::slot> slots;
+    while(auto slot = buffer.try_alloc(30)) {
+        slots.push_back(std::move(slot));
+    }
+
+    // bulk traffic filled the ring, the reserved capacity is still available
+    auto urgent = buffer.try_alloc(100, messagecache::priority::high);
+    ASSERT_TRUE(urgent.valid());
+    ASSERT_EQ(urgent.end() - urgent.begin(), 100);
+
+    // the reserve returns once the bulk in front of the high priority slot drained
+    for(int i = 0; i < 20; ++i) {
+        urgent.release();
+        auto const drained = std::min(slots.size(), slots.size() / 2 + i);
+        slots.erase(slots.begin(), slots.begin() + drained);
+        while(auto slot = buffer.try_alloc(30)) {
+            slots.push_back(std::move(slot));
+        }
+        urgent = buffer.try_alloc(100, messagecache::priority::high);
+        ASSERT_TRUE(urgent.valid());
+    }
+}
+
+TEST(ring_buffer_test, no_reserve_by_default) {
+    messagecache::ring_buffer<20> buffer;
+
+    auto slot = buffer.try_alloc(16);
+    ASSERT_TRUE(slot.valid());
+    ASSERT_FALSE(buffer.try_alloc(1, messagecache::priority::high).valid());
+}
+
+TEST(ring_buffer_test, max_slot_size_fits_drained_ring) {
+    messagecache::ring_buffer<201> small;
+    auto const max = small.max_slot_size();
+    ASSERT_TRUE(small.try_alloc(max).valid());
+    ASSERT_FALSE(small.try_alloc(max + 1).valid());
+
+    // limited by the length field of the slot header
+    messagecache::ring_buffer<1 << 20> large;
+    ASSERT_LE(large.max_slot_size(), 65535u);
+    ASSERT_TRUE(large.try_alloc(large.max_slot_size()).valid());
+    ASSERT_FALSE(large.try_alloc(large.max_slot_size() + 1).valid());
+
+    // normal allocations leave the reserved capacity alone
+    small.reserve(50);
+    auto const normal = small.max_slot_size();
+    ASSERT_LT(normal, small.max_slot_size(messagecache::priority::high));
+    ASSERT_TRUE(small.try_alloc(normal).valid());
+    ASSERT_FALSE(small.try_alloc(normal + 1).valid());
+    ASSERT_TRUE(small.try_alloc(max, messagecache::priority::high).valid());
+}
+
+TYPED_TEST(ring_buffer_policy_test, release_batch_returns_slots_on_publish) {
+    using buffer_type = messagecache::ring_buffer<1000, TypeParam>;
+    buffer_type buffer;
+
+    std::deque<typename buffer_type::slot> slots;
+    while(auto slot = buffer.try_alloc(30)) {
+        slots.push_back(std::move(slot));
+    }
+    {
+        typename buffer_type::template release_batch<256> batch{buffer};
+
+        // in order run at the free cursor, followed by an out of order slot
+        batch.release(std::move(slots[0]));
+        batch.release(std::move(slots[1]));
+        batch.release(std::move(slots[3]));
+        ASSERT_FALSE(slots[0].valid());
+        ASSERT_EQ(batch.size(), 3u);
+
+        // the slots stay occupied until the batch is published
+        ASSERT_FALSE(buffer.try_alloc(30).valid());
+    }
+
+    // the ring keeps the free and the write cursor apart, two freed slots hold one
+    slots.push_back(buffer.try_alloc(30));
+    ASSERT_TRUE(slots.back().valid());
+    ASSERT_FALSE(buffer.try_alloc(30).valid());
+
+    // releasing slots[2] frees slots[3] as well
+    slots[2].release();
+    slots.push_back(buffer.try_alloc(30));
+    ASSERT_TRUE(slots.back().valid());
+    slots.push_back(buffer.try_alloc(30));
+    ASSERT_TRUE(slots.back().valid());
+    ASSERT_FALSE(buffer.try_alloc(30).valid());
+}
+
+TEST(ring_buffer_test, release_batch_publishes_when_full) {
+    messagecache::ring_buffer<1000> buffer;
+    decltype(buffer)::release_batch<2> batch{buffer};
+
+    auto a = buffer.try_alloc(500);
+    auto b = buffer.try_alloc(400);
+    ASSERT_FALSE(buffer.try_alloc(400).valid());
+
+    batch.release(std::move(a));
+    ASSERT_FALSE(buffer.try_alloc(400).valid());
+
+    batch.release(std::move(b));
+    ASSERT_EQ(batch.size(), 0u);
+    ASSERT_TRUE(buffer.try_alloc(900).valid());
+}
+
+TYPED_TEST(ring_buffer_policy_test, overflow_rings_absorb_bursts) {
+    using buffer_type = messagecache::ring_buffer<2 * footprint(40), TypeParam>;
+    buffer_type buffer;
+    buffer.set_overflow(2);
+
+    // each ring holds two slots of 40 bytes
+    std::deque<typename buffer_type::slot> slots;
+    while(auto slot = buffer.try_alloc(40)) {
+        slots.push_back(std::move(slot));
+    }
+    ASSERT_EQ(slots.size(), 6u);
+    ASSERT_EQ(buffer.overflow_rings(), 2u);
+
+    // the ring is preferred once it has room again, drained overflow rings retire
+    slots.erase(slots.begin(), slots.begin() + 5);
+    ASSERT_TRUE(buffer.try_alloc(40).valid());
+    ASSERT_EQ(buffer.overflow_rings(), 1u);
+
+    slots.clear();
+    ASSERT_TRUE(buffer.try_alloc(40).valid());
+    ASSERT_EQ(buffer.overflow_rings(), 0u);
+}
+
+TEST(ring_buffer_test, preallocated_overflow_rings_are_kept) {
+    messagecache::ring_buffer<100> buffer;
+    buffer.set_overflow(1, 1);
+    ASSERT_EQ(buffer.overflow_rings(), 1u);
+
+    auto a = buffer.try_alloc(90);
+    auto b = buffer.try_alloc(90);
+    ASSERT_TRUE(b.valid());
+    ASSERT_FALSE(buffer.try_alloc(90).valid());
+
+    b.release();
+    a.release();
+    ASSERT_TRUE(buffer.try_alloc(90).valid());
+    ASSERT_EQ(buffer.overflow_rings(), 1u);
+}
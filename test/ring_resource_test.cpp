@@ -0,0 +1,107 @@
+
+#include <gtest/gtest.h>
+#include <messagecache/ring_buffer.hpp>
+#include <messagecache/ring_resource.hpp>
+
+#include <memory_resource>
+#include <string>
+#include <vector>
+
+using ring_type = messagecache::ring_buffer<16384>;
+
+// counts the allocations that reach the upstream resource
+class counting_resource : public std::pmr::memory_resource
+{
+public:
+    std::size_t allocations = 0;
+    std::size_t deallocations = 0;
+
+protected:
+    auto do_allocate(std::size_t bytes, std::size_t alignment) -> void* override
+    {
+        ++allocations;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void* ptr, std::size_t bytes, std::size_t alignment) override
+    {
+        ++deallocations;
+        std::pmr::new_delete_resource()->deallocate(ptr, bytes, alignment);
+    }
+
+    auto do_is_equal(const std::pmr::memory_resource& other) const noexcept
+        -> bool override
+    {
+        return this == &other;
+    }
+};
+
+TEST(ring_resource_test, containers_live_in_the_ring) {
+    messagecache::ring_buffer<65536> ring;
+    counting_resource upstream;
+    messagecache::ring_resource<decltype(ring)> resource(ring, 4096, &upstream);
+
+    std::pmr::vector<std::pmr::string> fields(&resource);
+    for(int i = 0; i < 100; ++i) {
+        fields.emplace_back("a field that does not fit into the small string buffer");
+    }
+    ASSERT_EQ(fields[99], "a field that does not fit into the small string buffer");
+    ASSERT_EQ(upstream.allocations, 0u);
+}
+
+TEST(ring_resource_test, allocations_are_aligned) {
+    ring_type ring;
+    messagecache::ring_resource<ring_type> resource(ring);
+
+    for(std::size_t alignment : {1, 2, 4, 8, 16, 32, 64}) {
+        auto* ptr = resource.allocate(3, alignment);
+        ASSERT_EQ(reinterpret_cast<std::uintptr_t>(ptr) % alignment, 0u);
+    }
+}
+
+TEST(ring_resource_test, release_hands_memory_back) {
+    messagecache::ring_buffer<4096> ring;
+    {
+        messagecache::ring_resource<decltype(ring)> resource(ring, 1024);
+        for(int i = 0; i < 3; ++i) {
+            ASSERT_NE(resource.allocate(900), nullptr);
+        }
+        ASSERT_FALSE(ring.try_alloc(2048).valid());
+    }
+    ASSERT_TRUE(ring.try_alloc(4000).valid());
+}
+
+TEST(ring_resource_test, falls_back_to_upstream) {
+    messagecache::ring_buffer<1024> ring;
+    counting_resource upstream;
+    messagecache::ring_resource<decltype(ring)> resource(ring, 512, &upstream);
+
+    // larger than a slot of the ring
+    ASSERT_NE(resource.allocate(70000), nullptr);
+    ASSERT_EQ(upstream.allocations, 1u);
+
+    // the ring holds a single chunk
+    ASSERT_NE(resource.allocate(400), nullptr);
+    ASSERT_EQ(upstream.allocations, 1u);
+    ASSERT_NE(resource.allocate(400), nullptr);
+    ASSERT_EQ(upstream.allocations, 2u);
+
+    resource.release();
+    ASSERT_EQ(upstream.deallocations, 2u);
+    ASSERT_TRUE(ring.try_alloc(1000).valid());
+}
+
+TEST(ring_resource_test, chunks_fit_into_the_reserved_ring) {
+    messagecache::ring_buffer<4096> ring;
+    ring.reserve(1024);
+    counting_resource upstream;
+    messagecache::ring_resource<decltype(ring)> resource(ring, 4096, &upstream);
+
+    // the chunks shrink to the largest slot the ring grants
+    ASSERT_NE(resource.allocate(100), nullptr);
+    ASSERT_NE(resource.allocate(2000), nullptr);
+    ASSERT_EQ(upstream.allocations, 0u);
+
+    ASSERT_NE(resource.allocate(ring.max_slot_size()), nullptr);
+    ASSERT_EQ(upstream.allocations, 1u);
+}
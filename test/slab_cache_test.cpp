@@ -0,0 +1,129 @@
+#include <gtest/gtest.h>
+#include <messagecache/ring_buffer.hpp>
+#include <messagecache/slab_cache.hpp>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+using ring_type = messagecache::ring_buffer<16384>;
+
+TEST(slab_cache_test, alloc_tiny) {
+    ring_type ring;
+    messagecache::slab_cache<ring_type> cache(ring);
+
+    auto slot = cache.try_alloc(16);
+
+    ASSERT_TRUE(slot.valid());
+    ASSERT_EQ(slot.end() - slot.begin(), 16);
+
+    memset(slot.begin(), 'a', 16);
+    for(std::byte v : slot) {
+        ASSERT_EQ(static_cast<char>(v), 'a');
+    }
+}
+
+TEST(slab_cache_test, rejects_large_sizes) {
+    ring_type ring;
+    messagecache::slab_cache<ring_type> cache(ring);
+
+    ASSERT_FALSE(cache.try_alloc(0).valid());
+    ASSERT_FALSE(cache.try_alloc(65).valid());
+}
+
+TEST(slab_cache_test, chunks_do_not_overlap) {
+    ring_type ring;
+    messagecache::slab_cache<ring_type> cache(ring);
+
+    auto a = cache.try_alloc(10);
+    auto b = cache.try_alloc(16);
+    auto c = cache.try_alloc(40);
+
+    ASSERT_GE(b.begin() - a.begin(), 16);
+    // another size class lives in another slab
+    ASSERT_TRUE(c.end() <= a.begin() or c.begin() >= b.end());
+}
+
+TEST(slab_cache_test, reuses_released_chunks) {
+    ring_type ring;
+    messagecache::slab_cache<ring_type> cache(ring);
+
+    auto a = cache.try_alloc(16);
+    auto* first = a.begin();
+    a.release();
+
+    auto b = cache.try_alloc(16);
+    ASSERT_EQ(b.begin(), first);
+}
+
+TEST(slab_cache_test, empty_slabs_return_to_ring) {
+    ring_type ring;
+
+    {
+        messagecache::slab_cache<ring_type> cache(ring);
+        std::vector<decltype(cache)::slot> slots;
+
+        // fill the ring with slabs
+        while(true) {
+            auto slot = cache.try_alloc(64);
+            if(not slot) {
+                break;
+            }
+            slots.push_back(std::move(slot));
+        }
+        ASSERT_FALSE(ring.try_alloc(8000).valid());
+
+        // the slots outlive the cache
+        slots.clear();
+    }
+
+    ASSERT_TRUE(ring.try_alloc(8000).valid());
+}
+
+TEST(slab_cache_test, release_from_other_thread) {
+    using large_ring_type = messagecache::ring_buffer<65536>;
+    large_ring_type ring;
+    messagecache::slab_cache<large_ring_type> cache(ring);
+
+    for(int round = 0; round < 100; ++round) {
+        std::vector<decltype(cache)::slot> slots;
+        for(int i = 0; i < 300; ++i) {
+            auto slot = cache.try_alloc(32);
+            ASSERT_TRUE(slot.valid());
+            slots.push_back(std::move(slot));
+        }
+
+        std::thread([&] { slots.clear(); }).join();
+    }
+}
+
+TEST(slab_cache_test, flush_publishes_to_other_thread) {
+    using large_ring_type = messagecache::ring_buffer<65536>;
+    large_ring_type ring;
+    messagecache::slab_cache<large_ring_type> cache(ring);
+
+    std::vector<decltype(cache)::slot> slots;
+    for(int i = 0; i < 200; ++i) {
+        slots.push_back(cache.try_alloc(16));
+        ASSERT_TRUE(slots.back().valid());
+    }
+
+    std::thread producer([&] {
+        for(int i = 0; i < 200; ++i) {
+            auto span = slots[i].asMutableSpan(messagecache::same_thread);
+            std::fill(span.begin(), span.end(), static_cast<std::byte>(i));
+            slots[i].flush();
+        }
+    });
+
+    // only the chunks' states order the data
+    for(int i = 0; i < 200; ++i) {
+        while(not slots[i].synchronize()) {
+            std::this_thread::yield();
+        }
+        for(std::byte v : slots[i].asSpan()) {
+            ASSERT_EQ(v, static_cast<std::byte>(i));
+        }
+    }
+    producer.join();
+}
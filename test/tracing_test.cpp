@@ -0,0 +1,100 @@
+
+#include <gtest/gtest.h>
+#include <messagecache/ring_buffer.hpp>
+#include <messagecache/tracing.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+static_assert(messagecache::tracing::enabled, "build with MESSAGECACHE_ENABLE_TRACING");
+
+using ring_type = messagecache::ring_buffer<4096>;
+
+TEST(tracing_test, records_the_lifetime_of_a_message) {
+    messagecache::tracing::reset();
+
+    ring_type ring;
+    auto slot = ring.try_alloc(100);
+    ASSERT_TRUE(slot.valid());
+    slot.flush();
+
+    std::thread consumer([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        slot.synchronize();
+        slot.release();
+    });
+    consumer.join();
+
+    auto const report = messagecache::tracing::snapshot();
+    ASSERT_EQ(report.fill.count(), 1u);
+    ASSERT_EQ(report.handoff.count(), 1u);
+    ASSERT_EQ(report.residency.count(), 1u);
+
+    // the consumer waited before it picked up the message
+    ASSERT_GE(report.handoff.percentile(0.5), std::chrono::milliseconds(1));
+    ASSERT_GE(report.residency.percentile(0.5), std::chrono::milliseconds(1));
+}
+
+TEST(tracing_test, unpublished_slots_have_no_handoff) {
+    messagecache::tracing::reset();
+
+    ring_type ring;
+    {
+        auto slot = ring.try_alloc(100);
+        auto span = slot.asSpan();
+        ASSERT_EQ(span.size(), 100u);
+    }
+
+    auto const report = messagecache::tracing::snapshot();
+    ASSERT_EQ(report.fill.count(), 0u);
+    ASSERT_EQ(report.handoff.count(), 0u);
+    ASSERT_EQ(report.residency.count(), 1u);
+}
+
+TEST(tracing_test, headers_keep_the_timestamps_aligned) {
+    ring_type ring;
+    auto a = ring.try_alloc(3);
+    auto b = ring.try_alloc(5);
+    ASSERT_EQ(reinterpret_cast<std::uintptr_t>(a.begin()) % 8, 0u);
+    ASSERT_EQ(reinterpret_cast<std::uintptr_t>(b.begin()) % 8, 0u);
+    ASSERT_EQ(b.end() - b.begin(), 5);
+}
+
+TEST(tracing_test, percentiles_of_a_distribution) {
+    messagecache::tracing::distribution dist;
+    ASSERT_EQ(dist.percentile(0.5), std::chrono::nanoseconds{0});
+
+    dist.buckets[3] = 90; // [8, 16) ns
+    dist.buckets[10] = 10; // [1024, 2048) ns
+    ASSERT_EQ(dist.count(), 100u);
+    ASSERT_EQ(dist.percentile(0.5), std::chrono::nanoseconds{15});
+    ASSERT_EQ(dist.percentile(0.99), std::chrono::nanoseconds{2047});
+}
+
+TEST(tracing_test, repeated_accesses_count_once) {
+    messagecache::tracing::reset();
+
+    ring_type ring;
+    auto slot = ring.try_alloc(100);
+    slot.flush();
+    slot.flush();
+
+    std::thread consumer([&] {
+        slot.synchronize();
+        ASSERT_EQ(slot.asSpan().size(), 100u);
+        slot.synchronize();
+    });
+    consumer.join();
+
+    // a late flush by the producer neither counts nor resets the handoff
+    slot.flush();
+    std::thread other([&] { slot.synchronize(); });
+    other.join();
+    slot.release();
+
+    auto const report = messagecache::tracing::snapshot();
+    ASSERT_EQ(report.fill.count(), 1u);
+    ASSERT_EQ(report.handoff.count(), 1u);
+    ASSERT_EQ(report.residency.count(), 1u);
+}